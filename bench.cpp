@@ -0,0 +1,115 @@
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+#include <algorithm>
+#include <initializer_list>
+
+#include "render.h"
+#include "effects.h"
+#include "renderer.h"
+#include "ledstrip.h"
+#include "config.h"
+
+// On-target benchmark firmware (ledcontrol_bench): times the render pipeline stages on the RP2040 with the hardware
+// timer, for every effect and format over a few LED counts, and prints the results over USB/UART.
+//
+// Result lines are CSV prefixed with "BENCH," so they can be grepped out of the serial log:
+//   BENCH,stage,effect,format,leds,frames,us_per_frame,cycles_per_led
+// A run starts with the header line (stage is "stage") and ends with "BENCH,done". Runs repeat every few seconds, so
+// a late serial connection still gets a full table.
+//
+// Stages:
+//   render      Renderer::cycle_loop: SineTable, frame params and the effect's kernel
+//   transition  Renderer::effective_brightness during a fade, and its brightness scale (per frame, not per LED)
+//   brightness  the scale_frame output stage
+//   transmit    present() until the frame is out and latched, on LED_DATA_PIN with NUM_LEDS (wall time, not CPU)
+
+using namespace ledcontrol;
+
+static const uint32_t LED_COUNTS[] = {10, 100, 300, 1000, 3000};
+static const uint32_t FRAMES = 100;
+static const uint32_t TRANSMIT_FRAMES = 20;
+
+static volatile uint32_t sink; // so the compiler can't drop the work
+
+static void print_result(const char *stage, const char *effect, const char *format, uint32_t leds, uint32_t frames, uint64_t us) {
+  float us_per_frame = (float)us / frames;
+  float cycles_per_led = us_per_frame * (clock_get_hz(clk_sys) / 1000000) / leds;
+  printf("BENCH,%s,%s,%s,%lu,%lu,%.1f,%.1f\n", stage, effect, format, (unsigned long)leds, (unsigned long)frames, us_per_frame, cycles_per_led);
+}
+
+static void bench_render(bool rgbw, uint32_t leds, uint32_t *frame, uint32_t *out) {
+  const char *format = rgbw ? "rgbw" : "rgb";
+  auto fns = effects::renderers(rgbw, LED_ORDER);
+  render::SineTable sine;
+
+  for (uint8_t effect = 0; effect < effects::All::count; effect++) {
+    const char *name = effects::All::names[effect];
+
+    uint64_t start = time_us_64();
+    for (uint32_t n = 0; n < FRAMES; n++) {
+      sine.build(leds);
+      float t = (float)(n * (1000 / UPDATES)) * DEFAULT_STATE.speed;
+      effects::frame_t f = {
+        .frame = frame,
+        .num_leds = leds,
+        .sine = &sine,
+        .p = render::frame_params(DEFAULT_STATE.hue, t / 200.0f, DEFAULT_STATE.angle, 1.0f),
+      };
+      effects::All::render(fns, effect, f);
+    }
+    print_result("render", name, format, leds, FRAMES, time_us_64() - start);
+  }
+
+  Renderer::snapshot_t snap = {};
+  snap.brightness = DEFAULT_STATE.brightness;
+  snap.transition_start_time = 1;
+  snap.transition_duration = 0xFFFFFFF0; // always mid-fade
+  snap.transition_target_brightness = DEFAULT_STATE.brightness;
+  uint64_t start = time_us_64();
+  for (uint32_t n = 0; n < FRAMES; n++) {
+    sink = render::brightness_scale(Renderer::effective_brightness(snap, 1 + n * (1000 / UPDATES)));
+  }
+  print_result("transition", "-", format, leds, FRAMES, time_us_64() - start);
+
+  start = time_us_64();
+  for (uint32_t n = 0; n < FRAMES; n++) {
+    sink = render::scale_frame(frame, out, leds, 1 + (n & 0xFF));
+  }
+  print_result("brightness", "-", format, leds, FRAMES, time_us_64() - start);
+}
+
+static void bench_transmit(LEDStrip *strip) {
+  // dim, so it doesn't matter what's connected
+  for (uint32_t i = 0; i < strip->num_leds; i++) strip->back_buffer()[i] = 0x01010100;
+
+  strip->wait();
+  uint64_t start = time_us_64();
+  for (uint32_t n = 0; n < TRANSMIT_FRAMES; n++) {
+    while (!strip->ready()) tight_loop_contents();
+    strip->present();
+  }
+  strip->wait();
+  print_result("transmit", "-", LED_RGBW ? "rgbw" : "rgb", strip->num_leds, TRANSMIT_FRAMES, time_us_64() - start);
+}
+
+int main() {
+  stdio_init_all();
+
+  uint32_t max_leds = 0;
+  for (auto leds : LED_COUNTS) max_leds = std::max(max_leds, leds);
+  auto *frame = new uint32_t[max_leds]();
+  auto *out = new uint32_t[max_leds]();
+
+  auto *strip = new LEDStrip(NUM_LEDS, pio0, LED_DATA_PIN, LED_RGBW, LED_PARALLEL_STRIPS);
+  strip->init();
+
+  while (true) {
+    sleep_ms(5000);
+    printf("BENCH,stage,effect,format,leds,frames,us_per_frame,cycles_per_led\n");
+    for (bool rgbw : {false, true}) {
+      for (auto leds : LED_COUNTS) bench_render(rgbw, leds, frame, out);
+    }
+    bench_transmit(strip);
+    printf("BENCH,done\n");
+  }
+}
@@ -0,0 +1,42 @@
+#include "boot.h"
+#include <cstdio>
+#include "logging.h"
+
+using namespace ledcontrol;
+
+const char *boot::stage_names[STAGE_COUNT] = {
+  "leds",
+  "radio",
+  "wifi_join",
+  "dhcp",
+  "dns",
+  "tls",
+  "mqtt",
+};
+
+static uint32_t _marks[boot::STAGE_COUNT];
+
+void boot::mark(STAGE stage) {
+  if (_marks[stage] != 0) return;
+  _marks[stage] = time_us_32();
+  LOG_INFO("[boot] %s at %lu ms\n", stage_names[stage], _marks[stage] / 1000);
+}
+
+uint32_t boot::get(STAGE stage) {
+  return _marks[stage];
+}
+
+void boot::print() {
+  printf("[boot] stage: ms since power on (ms since the previous stage)\n");
+  uint32_t prev = 0;
+  for (uint8_t i = 0; i < STAGE_COUNT; i++) {
+    if (_marks[i] == 0) {
+      printf("[boot] %s: -\n", stage_names[i]);
+      continue;
+    }
+    printf("[boot] %s: %lu.%03lu (+%lu.%03lu)\n", stage_names[i], (unsigned long)(_marks[i] / 1000),
+           (unsigned long)(_marks[i] % 1000), (unsigned long)((_marks[i] - prev) / 1000),
+           (unsigned long)((_marks[i] - prev) % 1000));
+    prev = _marks[i];
+  }
+}
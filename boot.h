@@ -0,0 +1,36 @@
+#ifndef BOOT_H
+#define BOOT_H
+
+#include <cstdint>
+#include "pico/stdlib.h"
+
+// Boot timeline: when each boot stage first completed, in us since power on. Only the first time counts, so
+// reconnections later on don't move the marks.
+
+namespace ledcontrol {
+  namespace boot {
+
+    enum STAGE : uint8_t {
+        LEDS = 0,   // state restored from flash, rendering on core1
+        RADIO,      // cyw43_arch_init
+        WIFI_JOIN,  // associated with the access point
+        DHCP,       // got an address: the link is up
+        DNS,        // broker resolved
+        TLS,        // TLS config created (the handshake itself is part of MQTT)
+        MQTT,       // broker accepted the connection
+
+        STAGE_COUNT
+    };
+
+    extern const char *stage_names[STAGE_COUNT];
+
+    // mark records the stage's completion time, unless it was recorded already
+    void mark(STAGE stage);
+    // get returns when the stage completed in us since boot, or 0 if it didn't yet
+    uint32_t get(STAGE stage);
+    // print writes the timeline to stdio
+    void print();
+  }
+}
+
+#endif //BOOT_H
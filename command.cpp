@@ -0,0 +1,396 @@
+#include "command.h"
+#include <cmath>
+#include <cstring>
+
+using namespace ledcontrol;
+
+// same as cJSON's CJSON_NESTING_LIMIT
+static const uint32_t NESTING_LIMIT = 1000;
+
+static const double POW10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                               1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+static int hex_digit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// hex4 is cJSON's parse_hex4: anything that isn't 4 hex digits is 0
+static uint32_t hex4(const char *s) {
+  uint32_t h = 0;
+  for (int i = 0; i < 4; i++) {
+    int d = hex_digit(s[i]);
+    if (d < 0) return 0;
+    h = (h << 4) | d;
+  }
+  return h;
+}
+
+static bool lower_equals(const char *a, const char *b) {
+  for (; *a != '\0' || *b != '\0'; a++, b++) {
+    char ca = (*a >= 'A' && *a <= 'Z') ? *a + 32 : *a;
+    if (ca != *b) return false;
+  }
+  return true;
+}
+
+namespace {
+  class Parser {
+    public:
+      Parser(const char *data, size_t len) : p(data), end(data + len) {}
+
+      int parse(command::command_t *cmd) {
+        if (p == end) return -1;
+        if (end - p >= 5 && memcmp(p, "\xEF\xBB\xBF", 3) == 0) p += 3; // UTF-8 BOM
+        skip_ws();
+
+        // anything after the top-level value is ignored
+        if (p < end && *p == '{') return object(cmd, false) ? 0 : -1;
+        return skip_value() ? 0 : -1;
+      }
+
+    private:
+      const char *p;
+      const char *end;
+      uint32_t depth = 0; // objects we're in, outside of skip_value()
+
+      void skip_ws() {
+        while (p < end && (uint8_t)*p <= 32) p++;
+      }
+
+      // string reads the string at p into out (NUL terminated, truncated to cap), or only skips it if out is null
+      bool string(char *out, size_t cap) {
+        if (p >= end || *p != '"') return false;
+        const char *s = p + 1;
+
+        // find the closing quote first: a string that doesn't end fails before its escapes are looked at
+        const char *q = s;
+        while (q < end && *q != '"') {
+          if (*q == '\\') {
+            if (q + 1 >= end) return false;
+            q++;
+          }
+          q++;
+        }
+        if (q >= end) return false;
+
+        size_t n = 0;
+        auto put = [&](char c) {
+          if (out != nullptr && n + 1 < cap) out[n] = c;
+          n++;
+        };
+
+        while (s < q) {
+          if (*s != '\\') {
+            put(*s++);
+            continue;
+          }
+
+          switch (s[1]) {
+            case 'b': put('\b'); break;
+            case 'f': put('\f'); break;
+            case 'n': put('\n'); break;
+            case 'r': put('\r'); break;
+            case 't': put('\t'); break;
+            case '"':
+            case '\\':
+            case '/': put(s[1]); break;
+            case 'u': {
+              if (q - s < 6) return false;
+              uint32_t cp = hex4(s + 2);
+              size_t l = 6;
+              if (cp >= 0xDC00 && cp <= 0xDFFF) return false;
+              if (cp >= 0xD800 && cp <= 0xDBFF) {
+                const char *low = s + 6;
+                if (q - low < 6 || low[0] != '\\' || low[1] != 'u') return false;
+                uint32_t lcp = hex4(low + 2);
+                if (lcp < 0xDC00 || lcp > 0xDFFF) return false;
+                cp = 0x10000 + (((cp & 0x3FF) << 10) | (lcp & 0x3FF));
+                l = 12;
+              }
+
+              if (cp < 0x80) {
+                put(cp);
+              } else if (cp < 0x800) {
+                put(0xC0 | (cp >> 6));
+                put(0x80 | (cp & 0x3F));
+              } else if (cp < 0x10000) {
+                put(0xE0 | (cp >> 12));
+                put(0x80 | ((cp >> 6) & 0x3F));
+                put(0x80 | (cp & 0x3F));
+              } else {
+                put(0xF0 | (cp >> 18));
+                put(0x80 | ((cp >> 12) & 0x3F));
+                put(0x80 | ((cp >> 6) & 0x3F));
+                put(0x80 | (cp & 0x3F));
+              }
+              s += l;
+              continue;
+            }
+            default:
+              return false;
+          }
+          s += 2;
+        }
+
+        if (out != nullptr && cap > 0) out[n < cap ? n : cap - 1] = '\0';
+        p = q + 1;
+        return true;
+      }
+
+      // number reads what strtod would from the longest run of [0-9+-eE.] at p, which is what cJSON hands it. p must
+      // be at a '-' or a digit. Exact for up to 15 significant digits and exponents up to 22.
+      bool number(double *v) {
+        const char *s = p;
+        const char *run = p;
+        while (run < end && ((*run >= '0' && *run <= '9') || *run == '+' || *run == '-' || *run == 'e' || *run == 'E' || *run == '.')) run++;
+
+        bool neg = false;
+        if (s < run && (*s == '+' || *s == '-')) neg = *s++ == '-';
+
+        uint64_t mant = 0;
+        int kept = 0; // significant digits in mant
+        int exp10 = 0;
+        int digits = 0;
+        for (; s < run && *s >= '0' && *s <= '9'; s++, digits++) {
+          if (mant == 0 && *s == '0') continue;
+          if (kept < 19) {
+            mant = mant * 10 + (*s - '0');
+            kept++;
+          } else {
+            exp10++;
+          }
+        }
+        if (s < run && *s == '.') {
+          s++;
+          for (; s < run && *s >= '0' && *s <= '9'; s++, digits++) {
+            if (mant == 0 && *s == '0') {
+              exp10--;
+              continue;
+            }
+            if (kept < 19) {
+              mant = mant * 10 + (*s - '0');
+              kept++;
+              exp10--;
+            }
+          }
+        }
+        if (digits == 0) return false;
+
+        if (s < run && (*s == 'e' || *s == 'E')) {
+          const char *e = s + 1;
+          bool eneg = false;
+          if (e < run && (*e == '+' || *e == '-')) eneg = *e++ == '-';
+          if (e < run && *e >= '0' && *e <= '9') {
+            int x = 0;
+            for (; e < run && *e >= '0' && *e <= '9'; e++) {
+              if (x < 100000) x = x * 10 + (*e - '0');
+            }
+            exp10 += eneg ? -x : x;
+            s = e;
+          }
+        }
+        p = s;
+
+        if (v != nullptr) {
+          double d;
+          if (mant == 0) {
+            d = 0.0;
+          } else if (kept <= 15 && exp10 >= -22 && exp10 <= 22) {
+            d = exp10 < 0 ? (double)mant / POW10[-exp10] : (double)mant * POW10[exp10];
+          } else {
+            d = (double)mant * pow(10.0, exp10);
+          }
+          *v = neg ? -d : d;
+        }
+        return true;
+      }
+
+      bool literal(const char *s, size_t n) {
+        if ((size_t)(end - p) < n || memcmp(p, s, n) != 0) return false;
+        p += n;
+        return true;
+      }
+
+      bool scalar() {
+        if (p >= end) return false;
+        switch (*p) {
+          case '"': return string(nullptr, 0);
+          case 't': return literal("true", 4);
+          case 'f': return literal("false", 5);
+          case 'n': return literal("null", 4);
+          case '-': return number(nullptr);
+          default: return *p >= '0' && *p <= '9' && number(nullptr);
+        }
+      }
+
+      // key reads an object member's key and the ':' after it
+      bool key(char *out, size_t cap) {
+        skip_ws();
+        if (!string(out, cap)) return false;
+        skip_ws();
+        if (p >= end || *p != ':') return false;
+        p++;
+        skip_ws();
+        return true;
+      }
+
+      // skip_value skips any value. Containers are tracked in a bit stack (set for objects) instead of recursing, the
+      // nesting limit would take a lot more stack than core0 has.
+      bool skip_value() {
+        uint8_t objects[NESTING_LIMIT / 8 + 1];
+        uint32_t n = 0;
+
+        while (true) {
+          skip_ws();
+          if (p >= end) return false;
+
+          char c = *p;
+          bool done = false; // with the value at p, including any container it opens
+          if (c == '{' || c == '[') {
+            if (depth + n >= NESTING_LIMIT) return false;
+            bool obj = c == '{';
+            if (obj) objects[n / 8] |= 1 << (n % 8);
+            else objects[n / 8] &= ~(1 << (n % 8));
+            n++;
+            p++;
+            skip_ws();
+            if (p < end && *p == (obj ? '}' : ']')) {
+              p++;
+              n--;
+              done = true;
+            } else if (obj && !key(nullptr, 0)) {
+              return false;
+            }
+          } else {
+            if (!scalar()) return false;
+            done = true;
+          }
+          if (!done) continue;
+
+          // after a value: close containers, until there's a next element to read
+          while (true) {
+            if (n == 0) return true;
+            skip_ws();
+            if (p >= end) return false;
+            bool obj = objects[(n - 1) / 8] & (1 << ((n - 1) % 8));
+            if (*p == ',') {
+              p++;
+              if (obj && !key(nullptr, 0)) return false;
+              break;
+            }
+            if (*p != (obj ? '}' : ']')) return false;
+            p++;
+            n--;
+          }
+        }
+      }
+
+      enum KEY : uint8_t {
+          KEY_OTHER = 0,
+          KEY_STATE,
+          KEY_EFFECT,
+          KEY_COLOR,
+          KEY_BRIGHTNESS,
+          KEY_TRANSITION,
+          KEY_H, // in color
+          KEY_S,
+      };
+
+      static KEY find_key(const char *k, bool color) {
+        if (color) {
+          if (lower_equals(k, "h")) return KEY_H;
+          if (lower_equals(k, "s")) return KEY_S;
+          return KEY_OTHER;
+        }
+        if (lower_equals(k, "state")) return KEY_STATE;
+        if (lower_equals(k, "effect")) return KEY_EFFECT;
+        if (lower_equals(k, "color")) return KEY_COLOR;
+        if (lower_equals(k, "brightness")) return KEY_BRIGHTNESS;
+        if (lower_equals(k, "transition")) return KEY_TRANSITION;
+        return KEY_OTHER;
+      }
+
+      // member reads the value of a known key into cmd if it has the right type, or skips it
+      bool member(command::command_t *cmd, KEY k, uint8_t *color_numbers) {
+        char c = p < end ? *p : '\0';
+        bool is_number = c == '-' || (c >= '0' && c <= '9');
+        bool ok;
+
+        switch (k) {
+          case KEY_STATE:
+          case KEY_EFFECT:
+            if (c != '"') break;
+            ok = k == KEY_STATE ? string(cmd->state, sizeof(cmd->state)) : string(cmd->effect, sizeof(cmd->effect));
+            if (ok) cmd->fields |= k == KEY_STATE ? command::STATE : command::EFFECT;
+            return ok;
+          case KEY_BRIGHTNESS:
+          case KEY_TRANSITION:
+            if (!is_number) break;
+            ok = number(k == KEY_BRIGHTNESS ? &cmd->brightness : &cmd->transition);
+            if (ok) cmd->fields |= k == KEY_BRIGHTNESS ? command::BRIGHTNESS : command::TRANSITION;
+            return ok;
+          case KEY_COLOR:
+            if (c != '{') break;
+            cmd->fields |= command::COLOR_OBJECT;
+            return object(cmd, true);
+          case KEY_H:
+          case KEY_S:
+            if (!is_number) break;
+            ok = number(k == KEY_H ? &cmd->h : &cmd->s);
+            if (ok) *color_numbers |= k == KEY_H ? 1 : 2;
+            return ok;
+          default:
+            break;
+        }
+        return skip_value();
+      }
+
+      // object reads the command object, or the color object in it
+      bool object(command::command_t *cmd, bool color) {
+        if (depth >= NESTING_LIMIT) return false;
+        depth++;
+        p++; // '{'
+        skip_ws();
+
+        uint32_t seen = 0; // KEYs we've had: only the first one of each counts
+        uint8_t color_numbers = 0;
+        if (p < end && *p == '}') {
+          p++;
+          depth--;
+          return true;
+        }
+
+        while (true) {
+          char kbuf[16];
+          if (!key(kbuf, sizeof(kbuf))) return false;
+
+          KEY k = find_key(kbuf, color);
+          if (seen & (1 << k)) k = KEY_OTHER;
+          seen |= 1 << k;
+          if (!member(cmd, k, &color_numbers)) return false;
+
+          skip_ws();
+          if (p >= end) return false;
+          if (*p == '}') break;
+          if (*p != ',') return false;
+          p++;
+        }
+
+        if (color && color_numbers == 3) cmd->fields |= command::COLOR;
+        p++;
+        depth--;
+        return true;
+      }
+  };
+}
+
+int command::parse(const char *data, size_t len, command_t *cmd) {
+  memset(cmd, 0, sizeof(*cmd));
+  Parser parser(data, len);
+  int res = parser.parse(cmd);
+  if (res != 0) cmd->fields = 0;
+  return res;
+}
@@ -0,0 +1,41 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include <cstdint>
+#include <cstddef>
+
+// Parser for the Home Assistant JSON schema light commands (see on_command in main.cpp). It reads the fields we use
+// straight from the MQTT payload, without allocating or building a tree, and skips everything else.
+//
+// It accepts and rejects the same documents as cJSON_ParseWithLength, and picks the same values as
+// cJSON_GetObjectItem: keys match case-insensitively, the first occurrence of a key wins, and anything after the
+// top-level value is ignored. A value of the wrong type is as good as a missing one.
+
+namespace ledcontrol {
+  namespace command {
+
+    enum FIELD : uint8_t {
+        STATE = 1 << 0,        // "state": string
+        EFFECT = 1 << 1,       // "effect": string
+        COLOR_OBJECT = 1 << 2, // "color": object
+        COLOR = 1 << 3,        // "color": {"h": number, "s": number}
+        BRIGHTNESS = 1 << 4,   // "brightness": number
+        TRANSITION = 1 << 5,   // "transition": number
+    };
+
+    typedef struct {
+        uint8_t fields; // FIELDs found, with the right type
+        char state[8];   // truncated if longer, which never matches a valid value anyway
+        char effect[48];
+        double h, s;
+        double brightness;
+        double transition; // seconds
+    } command_t;
+
+    // parse reads a command from the first len bytes of data (which needn't be NUL terminated). Returns 0, or -1 if
+    // it's not valid JSON.
+    int parse(const char *data, size_t len, command_t *cmd);
+  }
+}
+
+#endif //COMMAND_H
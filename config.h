@@ -16,6 +16,11 @@ const uint NUM_LEDS = 151;
 const bool LED_RGBW = true;
 //const bool LED_RGBW = false;
 
+// Set this to drive the LEDs as this many strips (up to 8) at the same time, on consecutive pins starting at
+// LED_DATA_PIN. The LEDs are split evenly: the first NUM_LEDS / LED_PARALLEL_STRIPS (rounded up) are on LED_DATA_PIN,
+// the next ones on LED_DATA_PIN + 1 and so on. Refresh time goes down by the same factor.
+const uint LED_PARALLEL_STRIPS = 1;
+
 // Change this if the colour order of your LED strip is different
 const WS2812::COLOR_ORDER LED_ORDER = WS2812::COLOR_ORDER::GRB;
 
@@ -51,8 +56,17 @@ const float_t MAX_BRIGHTNESS = 1.0f;
 const float_t MIN_SPEED = 0.0f;
 const float_t MAX_SPEED = 0.18f; // let's be safe and not trigger anyone
 
-// How many times the LEDs will be updated per second
+// How many times the LEDs will be updated per second, at most
 const uint UPDATES = 60;
+// The LEDs are updated less often when the animation changes slowly, down to MIN_UPDATES when it doesn't change at
+// all. The rate is picked so that no channel steps more than FRAME_MAX_STEP levels from one frame to the next.
+const uint MIN_UPDATES = 4;
+const uint FRAME_MAX_STEP = 2;
+// The full rate is kept for this long after encoder input (on/off and brightness changes fade at the full rate anyway)
+const uint32_t INPUT_FULL_RATE_MS = 3000;
+
+// At most this much of a main loop frame is spent printing buffered log records (see logging.h)
+const uint32_t LOG_DRAIN_BUDGET_US = 2000;
 
 // Default brightness for the encoder LED
 const float_t ENC_DEFAULT_BRIGHTNESS = 0.5f;
@@ -62,6 +76,14 @@ const uint LED_DATA_PIN = 28;
 const uint BUTTON_B_PIN = 27;
 const uint BUTTON_C_PIN = 26;
 
+// The strips take GPIO LED_DATA_PIN to LED_DATA_PIN + LED_PARALLEL_STRIPS - 1, which must all be on the header: GPIO29
+// doesn't exist on it (VSYS sense, and the radio's SPI clock on the Pico W), nor do GPIO23-25 (power and the board
+// LED, the radio on the Pico W)
+static_assert(LED_PARALLEL_STRIPS >= 1 && LED_PARALLEL_STRIPS <= 8, "LED_PARALLEL_STRIPS must be 1 to 8");
+static_assert(LED_DATA_PIN + LED_PARALLEL_STRIPS <= 29, "LED_DATA_PIN + LED_PARALLEL_STRIPS - 1 is past GPIO28");
+static_assert(LED_DATA_PIN + LED_PARALLEL_STRIPS <= 23 || LED_DATA_PIN >= 26,
+              "the LED data pins overlap GPIO23-25, which aren't on the header");
+
 //const bool PRESENCE_ENABLED = false;
 const bool PRESENCE_ENABLED = true;
 const bool PRESENCE_PIN_ENABLED = true;
@@ -75,6 +97,7 @@ const uint16_t PRESENCE_CHECK_INTERVAL = 1000; // ms
 
 const uint16_t FADE_IN_DURATION = 1000; // ms
 const uint16_t FADE_OUT_DURATION = 2000; // ms
+const uint32_t MAX_TRANSITION_DURATION = 60000; // ms. longest on/off fade accepted from a command's "transition"
 const uint16_t ENCODER_INACTIVITY_TIMEOUT = 10000; // ms. after 10 seconds, encoder will switch to off mode and encoder LED will turn off
 const uint16_t GLOBAL_INACTIVITY_TIMEOUT_SECS = 0; // ms. after 1 hour (3600) seconds of inactivity, LEDs will turn off. Set to 0 to disable.
 //const uint16_t GLOBAL_INACTIVITY_TIMEOUT_SECS = 3600; // ms. after 1 hour (3600) seconds of inactivity, LEDs will turn off. Set to 0 to disable.
@@ -16,11 +16,52 @@
 #define MQTT_SERVER_PORT 1883
 #endif
 
+// Brokers to connect to, as {host, port} pairs. If one can't be reached the next one is tried, so more can be added
+// as fallbacks, eg. {"192.168.1.2", 1883}. The build can set it instead: the host tests use a local broker.
+#ifndef MQTT_SERVERS
+#define MQTT_SERVERS {{MQTT_SERVER_HOST, MQTT_SERVER_PORT}}
+#endif
+
+// Reconnecting after a failure (or a lost connection) waits MQTT_RECONNECT_MIN_MS, doubling up to
+// MQTT_RECONNECT_MAX_MS while it keeps failing. The broker lookup and the connection each get MQTT_CONNECT_TIMEOUT_MS,
+// and WiFi is rejoined if it's not back after WIFI_JOIN_TIMEOUT_MS.
+#define MQTT_RECONNECT_MIN_MS 1000
+#define MQTT_RECONNECT_MAX_MS 60000
+#define MQTT_CONNECT_TIMEOUT_MS 15000
+#define WIFI_JOIN_TIMEOUT_MS 30000
+
+// The access point (BSSID and channel), DHCP lease and broker addresses of the last successful connection are kept in
+// this flash sector (the one after FLASH_TARGET_OFFSET in config.h), so a reboot rejoins without scanning. If the cached
+// access point doesn't answer within WIFI_FAST_JOIN_TIMEOUT_MS, the network is scanned as usual.
+#define WIFI_CACHE_FLASH_OFFSET ((1536 + 4) * 1024)
+#define WIFI_FAST_JOIN_TIMEOUT_MS 3000
+
+// Use the cached DHCP lease's address as soon as we've joined, instead of waiting for DHCP (which keeps running: if it
+// hands out another address, the connection is remade on that one). Only enable it if the router reserves the address
+// for this board: the cached lease may have expired, and nothing checks that no other host has the address now, so with
+// many devices on the network this can take another's address until DHCP answers.
+//#define WIFI_REUSE_LEASE
+
+// Or set a static address, and DHCP isn't used at all. WIFI_STATIC_DNS is optional.
+//#define WIFI_STATIC_IP "192.168.1.50"
+//#define WIFI_STATIC_NETMASK "255.255.255.0"
+//#define WIFI_STATIC_GATEWAY "192.168.1.1"
+//#define WIFI_STATIC_DNS "192.168.1.1"
+
+// Connect to the cached broker addresses instead of looking them up. If one can't be reached, it's looked up again.
+#define MQTT_CACHE_BROKER_ADDR
+
 // Enable this if you don't want certificate verification but still want to connect with TLS
 //#define MQTT_TLS_INSECURE
 
+// Offer the last TLS session when reconnecting, so the broker can resume it (session ticket or session id) and skip the
+// key exchange, which takes seconds on the Pico. Brokers that don't support it just do a full handshake.
+#define MQTT_TLS_SESSION_RESUMPTION
+
 //#define MQTT_SERVER_HOST "91.121.93.94"
-// add contents of https://test.mosquitto.org/ssl/mosquitto.org.crt (or your own cert) here, if you want to connect securely
+// add contents of https://test.mosquitto.org/ssl/mosquitto.org.crt (or your own cert) here, if you want to connect securely.
+// The build can set it instead: the host TLS test uses its own broker's.
+#ifndef MQTT_TLS_CERT
 #define MQTT_TLS_CERT "-----BEGIN CERTIFICATE-----\n" \
 "MIIEAzCCAuugAwIBAgIUBY1hlCGvdj4NhBXkZ/uLUZNILAwwDQYJKoZIhvcNAQEL\n" \
 "BQAwgZAxCzAJBgNVBAYTAkdCMRcwFQYDVQQIDA5Vbml0ZWQgS2luZ2RvbTEOMAwG\n" \
@@ -45,6 +86,7 @@
 "LdUdRudafMu5T5Xma182OC0/u/xRlEm+tvKGGmfFcN0piqVl8OrSPBgIlb+1IKJE\n" \
 "m/XriWr/Cq4h/JfB7NTsezVslgkBaoU=\n" \
 "-----END CERTIFICATE-----\n";
+#endif
 
 // Enable and configure these (similar format to MQTT_TLS_CERT) if you want client side certificates
 /*
@@ -82,6 +124,28 @@
 #define MQTT_HOME_ASSISTANT_DISCOVERY_PREFIX  "homeassistant/light/"
 //#define MQTT_HOME_ASSISTANT_DISCOVERY_PREFIX  ""
 
+// Discovery prefix of the diagnostics sensor (stage timings, see profile.h). It's published to MQTT_TOPIC_PREFIX
+// (and board id) + "/diag" every MQTT_DIAGNOSTICS_INTERVAL_MS. Set the interval to 0 to disable.
+#define MQTT_HOME_ASSISTANT_SENSOR_DISCOVERY_PREFIX  "homeassistant/sensor/"
+#define MQTT_DIAGNOSTICS_INTERVAL_MS 60000
+
+// QoS of each published topic. Retained messages (state and discovery configs) are replaced by the next one anyway,
+// so delivering them more than once is harmless.
+#define MQTT_STATE_QOS 2
+#define MQTT_CONFIG_QOS 2 // discovery configs
+#define MQTT_DIAGNOSTICS_QOS 0
+
+// A failed publish is retried after MQTT_PUBLISH_RETRY_MIN_MS, doubling up to MQTT_PUBLISH_RETRY_MAX_MS while it keeps
+// failing. At most MQTT_PUBLISH_MAX_IN_FLIGHT publishes wait for the broker at once (lwIP has room for
+// MQTT_REQ_MAX_IN_FLIGHT requests, subscriptions included).
+#define MQTT_PUBLISH_RETRY_MIN_MS 100
+#define MQTT_PUBLISH_RETRY_MAX_MS 10000
+#define MQTT_PUBLISH_MAX_IN_FLIGHT 2
+
+// Longest command accepted, in bytes. lwIP hands payloads over in pieces (of MQTT_VAR_HEADER_BUFFER_LEN), which are
+// put back together in a buffer of this size, longer ones are dropped.
+#define MQTT_RX_MAX_LEN 1024
+
 // Country code. Optionally, enable and change according to your country. Full list in https://raspberrypi.github.io/pico-sdk-doxygen/cyw43__country_8h.html
 //#define WIFI_COUNTRY_CODE CYW43_COUNTRY_UK
 
@@ -0,0 +1,51 @@
+#include "effects.h"
+#include "config.h"
+
+using namespace ledcontrol;
+using namespace ledcontrol::effects;
+
+template <typename F>
+void HueCycle::render(const frame_t &f) {
+  uint32_t frac, pos = f.sine->cursor(f.p.phase, &frac);
+  for(auto i = 0u; i < f.num_leds; ++i) {
+    uint8_t r, g, b;
+    render::hsv_q16(render::hue_at(f.p, f.sine->at(&pos, frac)), f.p.value, &r, &g, &b);
+    f.frame[i] = F::pack(r, g, b, 0);
+  }
+}
+
+template <typename F>
+void WhiteChase::render(const frame_t &f) {
+  uint32_t frac, pos = f.sine->cursor(f.p.phase, &frac);
+  for(auto i = 0u; i < f.num_leds; ++i) {
+    uint8_t white = render::white_q16(render::hue_at(f.p, f.sine->at(&pos, frac)), f.p.value);
+    if constexpr (F::RGBW) {
+      f.frame[i] = F::pack(0, 0, 0, white);
+    } else {
+      f.frame[i] = F::pack(white, white, white, 0);
+    }
+  }
+}
+
+const render_fn *effects::renderers() {
+  return All::renderers<render::PixelFormat<LED_RGBW, LED_ORDER>>;
+}
+
+#ifdef LEDCONTROL_ALL_PIXEL_FORMATS
+template <bool RGBW>
+static const render_fn *renderers_for(plasma::WS2812::COLOR_ORDER order) {
+  using ORDER = plasma::WS2812::COLOR_ORDER;
+  switch (order) {
+    case ORDER::RGB: return All::renderers<render::PixelFormat<RGBW, ORDER::RGB>>;
+    case ORDER::RBG: return All::renderers<render::PixelFormat<RGBW, ORDER::RBG>>;
+    case ORDER::GRB: default: return All::renderers<render::PixelFormat<RGBW, ORDER::GRB>>;
+    case ORDER::GBR: return All::renderers<render::PixelFormat<RGBW, ORDER::GBR>>;
+    case ORDER::BRG: return All::renderers<render::PixelFormat<RGBW, ORDER::BRG>>;
+    case ORDER::BGR: return All::renderers<render::PixelFormat<RGBW, ORDER::BGR>>;
+  }
+}
+
+const render_fn *effects::renderers(bool rgbw, plasma::WS2812::COLOR_ORDER order) {
+  return rgbw ? renderers_for<true>(order) : renderers_for<false>(order);
+}
+#endif
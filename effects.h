@@ -0,0 +1,134 @@
+#ifndef EFFECTS_H
+#define EFFECTS_H
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include "render.h"
+
+// Effects are types with a name and a whole frame render function, collected in a compile-time Registry. The
+// registry order is the effect number saved to flash and used by LEDControl::EFFECT_MODE, so only ever append to it.
+//
+// levels_per_turn is how many output levels a channel steps through while the hue goes around once. The frame-rate
+// governor (see Renderer::govern) uses it to tell how fast the effect visibly changes.
+
+namespace ledcontrol {
+  namespace effects {
+
+    // frame_t is everything an effect needs to render one frame
+    typedef struct {
+        uint32_t *frame; // num_leds pixel words, full brightness
+        uint32_t num_leds;
+        const render::SineTable *sine; // already built for num_leds
+        render::frame_params_t p;
+    } frame_t;
+
+    typedef void (*render_fn)(const frame_t &f);
+
+    // render functions are templates on the render::PixelFormat, see renderers() below
+    struct HueCycle {
+        static constexpr const char *name = "hue_cycle";
+        static constexpr uint16_t levels_per_turn = 6 * 255; // a channel ramps once in each of the 6 hue segments
+        template <typename F> static void render(const frame_t &f);
+    };
+
+    struct WhiteChase {
+        static constexpr const char *name = "white_chase";
+        static constexpr uint16_t levels_per_turn = 255;
+        template <typename F> static void render(const frame_t &f);
+    };
+
+    // name_hash is a seeded FNV-1a over the name, up to the end of the string or the first ':' (the speed separator)
+    constexpr uint32_t name_hash(const char *s, uint32_t seed) {
+      uint32_t h = 2166136261u ^ seed;
+      for (; *s != '\0' && *s != ':'; s++) h = (h ^ (uint8_t)*s) * 16777619u;
+      return h;
+    }
+
+    template <typename... E>
+    class Registry {
+      public:
+        static constexpr uint8_t count = sizeof...(E);
+        static constexpr const char *names[count] = {E::name...};
+        static constexpr uint16_t levels_per_turn[count] = {E::levels_per_turn...};
+
+        // index_of returns the effect number of T
+        template <typename T>
+        static constexpr uint8_t index_of() {
+          constexpr bool is_t[count] = {std::is_same<T, E>::value...};
+          for (uint8_t i = 0; i < count; i++) {
+            if (is_t[i]) return i;
+          }
+          return count;
+        }
+
+        // renderers is the render function of every effect, for pixel format F
+        template <typename F>
+        static constexpr render_fn renderers[count] = {&E::template render<F>...};
+
+        // render renders a frame of the given effect with one of the renderers tables. Unknown effects render the
+        // first one.
+        static void render(const render_fn *fns, uint8_t effect, const frame_t &f) {
+          fns[effect < count ? effect : 0](f);
+        }
+
+        // find returns the effect number for the name str starts with (followed by the end of the string or ':'),
+        // or -1 if there's no such effect. One hash and one string compare, see slots below.
+        static int find(const char *str) {
+          uint8_t i = slots.v[name_hash(str, seed) & (SLOTS - 1)];
+          if (i == EMPTY) return -1;
+          size_t n = strlen(names[i]);
+          if (strncmp(str, names[i], n) != 0 || (str[n] != '\0' && str[n] != ':')) return -1;
+          return i;
+        }
+
+      private:
+        static constexpr uint8_t EMPTY = 0xFF;
+        static constexpr uint32_t SLOTS = count <= 2 ? 4 : count <= 4 ? 8 : count <= 8 ? 16 : count <= 16 ? 32 : 64;
+        static_assert(count > 0 && count <= 32, "effect registry must have between 1 and 32 effects");
+
+        // find_seed looks for a seed that gives every name its own slot (a perfect hash), at compile time
+        static constexpr uint32_t find_seed() {
+          for (uint32_t seed = 0; seed < 10000; seed++) {
+            uint64_t used = 0;
+            bool ok = true;
+            for (uint8_t i = 0; i < count && ok; i++) {
+              uint64_t bit = (uint64_t)1 << (name_hash(names[i], seed) & (SLOTS - 1));
+              ok = (used & bit) == 0;
+              used |= bit;
+            }
+            if (ok) return seed;
+          }
+          return UINT32_MAX;
+        }
+        static constexpr uint32_t seed = find_seed();
+        static_assert(seed != UINT32_MAX, "no perfect hash seed found for the effect names");
+
+        typedef struct {
+            uint8_t v[SLOTS];
+        } slots_t;
+        static constexpr slots_t make_slots() {
+          slots_t s = {};
+          for (uint32_t i = 0; i < SLOTS; i++) s.v[i] = EMPTY;
+          for (uint8_t i = 0; i < count; i++) s.v[name_hash(names[i], seed) & (SLOTS - 1)] = i;
+          return s;
+        }
+        static constexpr slots_t slots = make_slots();
+    };
+
+    // All effects, in effect number order. Append only!
+    typedef Registry<HueCycle, WhiteChase> All;
+
+    // renderers returns the All::renderers table for the strip in config.h (LED_RGBW, LED_ORDER), the only format
+    // the firmware compiles in.
+    const render_fn *renderers();
+
+#ifdef LEDCONTROL_ALL_PIXEL_FORMATS
+    // renderers returns the All::renderers table for any strip type. It compiles in every format (12 of each render
+    // loop), so only the benchmarks build it.
+    const render_fn *renderers(bool rgbw, plasma::WS2812::COLOR_ORDER order);
+#endif
+  }
+}
+
+#endif //EFFECTS_H
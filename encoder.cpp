@@ -4,6 +4,7 @@
 #include <common/pimoroni_common.hpp>
 #include "hardware/gpio.h"
 #include "hardware/pwm.h"
+#include "frameclock.h"
 
 uint32_t pwm_set_freq_duty(uint slice_num, uint chan, uint32_t f, int d) {
   // from this article: https://www.i-programmer.info/programming/hardware/14849-the-pico-in-c-basic-pwm.html
@@ -114,6 +115,8 @@ void Encoder::set_brightness(float brightness) {
 void Encoder::_gpio_callback(uint gpio, uint32_t events) {
 //  bool val = gpio_get(gpio);
 //  printf("gpio:%d, events:%lu fall:%d rise:%d val:%d\n", gpio, events, events&GPIO_IRQ_EDGE_FALL?1:0, events&GPIO_IRQ_EDGE_RISE?1:0, val);
+  if (gpio != pin_enc_a && gpio != pin_enc_b && gpio != pin_enc_sw) return; // not ours
+
   if (gpio == pin_enc_sw) {
     if ((to_ms_since_boot(get_absolute_time())-_last_switch_time)>50) {
       _last_switch_time = to_ms_since_boot(get_absolute_time());
@@ -146,6 +149,8 @@ void Encoder::_gpio_callback(uint gpio, uint32_t events) {
 
 Encoder encoder;
 
+// This is the GPIO IRQ callback for the whole core, so it also gets the button edges (see LEDControl::init)
 void _encoder_gpio_callback(uint gpio, uint32_t events) {
   encoder._gpio_callback(gpio, events);
+  frame_clock.wake(); // handle input right away, not at the next frame
 }
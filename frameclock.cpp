@@ -0,0 +1,102 @@
+#include "frameclock.h"
+#include "hardware/timer.h"
+#include "hardware/sync.h"
+
+using namespace ledcontrol;
+
+static FrameClock *_frame_clocks[NUM_TIMERS] = {}; // by alarm number, for the IRQ handler
+
+static void _frame_clock_alarm_irq(uint alarm_num);
+
+void FrameClock::init(uint32_t p_period_us) {
+  period_us = p_period_us;
+  reset_stats();
+
+  alarm = hardware_alarm_claim_unused(true);
+  _frame_clocks[alarm] = this;
+  hardware_alarm_set_callback(alarm, _frame_clock_alarm_irq);
+
+  last_frame_us = time_us_64();
+  tick_us = last_frame_us;
+  deadline_us = last_frame_us + period_us;
+  hardware_alarm_set_target(alarm, from_us_since_boot(deadline_us));
+}
+
+// set_period changes the rate from now on. The pending deadline is moved too, so going from a slow rate to a fast one
+// doesn't have to wait out the rest of a long period first. Call it from the core that called init().
+void FrameClock::set_period(uint32_t p_period_us) {
+  if (p_period_us == period_us) return;
+
+  uint32_t ints = save_and_disable_interrupts();
+  period_us = p_period_us;
+  uint64_t next = tick_us + period_us;
+  if (next < deadline_us) {
+    deadline_us = next;
+    while (hardware_alarm_set_target(alarm, from_us_since_boot(deadline_us))) deadline_us += period_us;
+  }
+  restore_interrupts(ints);
+}
+
+void FrameClock::_alarm_irq() {
+  tick_us = deadline_us;
+  uint32_t t = ticks + 1;
+
+  // next deadline is relative to this one, not to now. If we're so late that it's already passed, skip it, and count
+  // it as a tick too so wait() sees it as missed.
+  deadline_us += period_us;
+  while (hardware_alarm_set_target(alarm, from_us_since_boot(deadline_us))) {
+    deadline_us += period_us;
+    t++;
+  }
+  ticks = t;
+}
+
+bool FrameClock::wait(void (*idle)()) {
+  while (ticks == seen_ticks && !woken) {
+    __wfe();
+    if (idle) idle();
+  }
+
+  if (ticks == seen_ticks) {
+    woken = false;
+    stats.early++;
+    return false;
+  }
+  woken = false;
+
+  uint32_t t = ticks;
+  uint64_t now = time_us_64();
+  uint32_t late = now - tick_us;
+  uint32_t period = now - last_frame_us;
+  stats.missed += t - seen_ticks - 1;
+  seen_ticks = t;
+  last_frame_us = now;
+
+  stats.frames++;
+  stats.late_total_us += late;
+  if (late > stats.late_max_us) stats.late_max_us = late;
+  if (period < stats.period_min_us) stats.period_min_us = period;
+  if (period > stats.period_max_us) stats.period_max_us = period;
+  return true;
+}
+
+void FrameClock::wake() {
+  woken = true;
+  __sev();
+}
+
+FrameClock::stats_t FrameClock::get_stats() {
+  return stats;
+}
+
+void FrameClock::reset_stats() {
+  stats = {};
+  stats.period_min_us = UINT32_MAX;
+}
+
+// IRQ "bindings" to homemade static methods
+static void _frame_clock_alarm_irq(uint alarm_num) {
+  if (_frame_clocks[alarm_num]) _frame_clocks[alarm_num]->_alarm_irq();
+}
+
+FrameClock frame_clock;
@@ -0,0 +1,57 @@
+#ifndef FRAMECLOCK_H
+#define FRAMECLOCK_H
+
+#include <cstdint>
+#include "pico/stdlib.h"
+
+namespace ledcontrol {
+
+    // FrameClock paces a loop with absolute deadlines kept by a hardware alarm, so the rate doesn't drift with the
+    // amount of work done per frame. Between deadlines the core sleeps in WFE. wake() (from an IRQ or the other core)
+    // ends the wait early, without moving the next deadline.
+    class FrameClock {
+      public:
+        typedef struct {
+            uint32_t frames;        // deadlines waited for
+            uint32_t missed;        // deadlines that passed while the loop was still busy
+            uint32_t early;         // waits ended early by wake()
+            uint32_t period_min_us; // between consecutive frame starts
+            uint32_t period_max_us;
+            uint32_t late_max_us;   // from the deadline to the loop running
+            uint64_t late_total_us;
+        } stats_t;
+
+        // init claims a hardware alarm and starts the clock. The alarm IRQ is handled on the core that calls this.
+        void init(uint32_t p_period_us);
+        // set_period changes the period from the current deadline on (see frameclock.cpp)
+        void set_period(uint32_t p_period_us);
+        uint32_t get_period() const { return period_us; }
+
+        // wait sleeps until the next deadline, or until wake() is called. idle (if set) is called every time the core
+        // wakes up in between, for things that need polling on any interrupt. Returns true for a deadline.
+        bool wait(void (*idle)() = nullptr);
+        // wake ends the current (or next) wait early. Safe from any core or IRQ.
+        void wake();
+
+        stats_t get_stats();
+        void reset_stats();
+
+        // IRQ "binding"
+        void _alarm_irq();
+
+      private:
+        int alarm = -1;
+        uint32_t period_us = 0;
+        uint64_t deadline_us = 0;  // next deadline
+        volatile uint32_t ticks = 0; // deadlines passed, incremented by the alarm IRQ
+        volatile uint64_t tick_us = 0; // time of the last deadline passed
+        volatile bool woken = false;
+        uint32_t seen_ticks = 0;
+        uint64_t last_frame_us = 0;
+        stats_t stats = {};
+    };
+}
+
+extern ledcontrol::FrameClock frame_clock; // main loop, on core0
+
+#endif //FRAMECLOCK_H
@@ -0,0 +1,228 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+
+#include "render.h"
+#include "effects.h"
+#include "renderer.h"
+#include "config.h"
+#include "command.h"
+
+// Host render kernel benchmark: every effect, over strip lengths and pixel formats, one stage at a time. These are the
+// stages Renderer runs per frame:
+//   render      Renderer::cycle_loop (SineTable, frame params, the effect's kernel)
+//   transition  Renderer::effective_brightness during a fade, and its brightness scale
+//   brightness  the output stage (render::scale_frame) that Renderer::set_brightness dirties
+//
+// usage: ledcontrol_host_bench [min_ms]
+//        ledcontrol_host_bench command [min_ms]
+//
+// Each measurement runs for at least min_ms (default 50). Output is CSV on stdout, one line per measurement:
+//   effect,format,leds,stage,frames,ns_per_frame,ns_per_led,frame_pct
+// where format is the colour order, with a w for RGBW strips, and frame_pct is ns_per_frame as a percentage of a 60Hz
+// frame (16.6ms). transition and brightness don't depend on the effect, so their effect is "-". transition costs the
+// same for any strip length, so its ns_per_led is empty. These are host numbers, see the ledcontrol_bench firmware for
+// the RP2040.
+//
+// Effects ending in ":unspecialised" are the same render loops with the pixel format looked up at runtime instead of
+// compiled in (see render::PixelFormat), as the baseline for the specialised ones.
+//
+// With "command", it benchmarks command::parse on typical Home Assistant commands instead:
+//   message,bytes,messages,ns_per_message,messages_per_sec
+
+using namespace ledcontrol;
+using bench_clock = std::chrono::steady_clock;
+
+static const uint32_t LED_COUNTS[] = {10, 30, 100, 300, 1000, 3000, 10000};
+static const double FRAME_NS = 1e9 / 60.0;
+
+static volatile uint32_t sink; // so the compiler can't drop the work
+
+// runtime_format_t is a render::PixelFormat as data, for the unspecialised render loops
+typedef struct {
+    uint8_t r_shift, g_shift, b_shift;
+    bool rgbw;
+} runtime_format_t;
+
+template <typename F>
+static runtime_format_t runtime_format() {
+  return {F::R_SHIFT, F::G_SHIFT, F::B_SHIFT, F::RGBW};
+}
+
+using ORDER = plasma::WS2812::COLOR_ORDER;
+
+static const struct {
+    const char *name;
+    bool rgbw;
+    ORDER order;
+    runtime_format_t runtime;
+} FORMATS[] = {
+#define FORMAT(name, rgbw, order) {name, rgbw, ORDER::order, runtime_format<render::PixelFormat<rgbw, ORDER::order>>()}
+    FORMAT("rgb", false, RGB), FORMAT("rbg", false, RBG), FORMAT("grb", false, GRB),
+    FORMAT("gbr", false, GBR), FORMAT("brg", false, BRG), FORMAT("bgr", false, BGR),
+    FORMAT("rgbw", true, RGB), FORMAT("rbgw", true, RBG), FORMAT("grbw", true, GRB),
+    FORMAT("gbrw", true, GBR), FORMAT("brgw", true, BRG), FORMAT("bgrw", true, BGR),
+#undef FORMAT
+};
+
+static inline uint32_t pack(const runtime_format_t &fmt, uint8_t r, uint8_t g, uint8_t b, uint8_t w) {
+  using pimoroni::GAMMA_8BIT;
+  return ((uint32_t)GAMMA_8BIT[r] << fmt.r_shift) | ((uint32_t)GAMMA_8BIT[g] << fmt.g_shift) |
+         ((uint32_t)GAMMA_8BIT[b] << fmt.b_shift) | GAMMA_8BIT[w];
+}
+
+// hue_cycle and white_chase are effects::HueCycle::render and effects::WhiteChase::render, on a runtime format.
+// noinline, so the format can't be propagated into them as a constant after all.
+static __attribute__((noinline)) void hue_cycle(const effects::frame_t &f, const runtime_format_t &fmt) {
+  uint32_t frac, pos = f.sine->cursor(f.p.phase, &frac);
+  for(auto i = 0u; i < f.num_leds; ++i) {
+    uint8_t r, g, b;
+    render::hsv_q16(render::hue_at(f.p, f.sine->at(&pos, frac)), f.p.value, &r, &g, &b);
+    f.frame[i] = pack(fmt, r, g, b, 0);
+  }
+}
+
+static __attribute__((noinline)) void white_chase(const effects::frame_t &f, const runtime_format_t &fmt) {
+  uint32_t frac, pos = f.sine->cursor(f.p.phase, &frac);
+  for(auto i = 0u; i < f.num_leds; ++i) {
+    uint8_t white = render::white_q16(render::hue_at(f.p, f.sine->at(&pos, frac)), f.p.value);
+    f.frame[i] = fmt.rgbw ? pack(fmt, 0, 0, 0, white) : pack(fmt, white, white, white, 0);
+  }
+}
+
+static const struct {
+    const char *name;
+    void (*render)(const effects::frame_t &f, const runtime_format_t &fmt);
+} UNSPECIALISED[] = {
+    {"hue_cycle:unspecialised", hue_cycle},
+    {"white_chase:unspecialised", white_chase},
+};
+static_assert(sizeof(UNSPECIALISED) / sizeof(UNSPECIALISED[0]) == effects::All::count, "an unspecialised loop per effect");
+
+typedef struct {
+    uint64_t frames;
+    double ns_per_frame;
+} result_t;
+
+// measure runs fn(frame) until min_ms passed, and returns the time per call
+template <typename F>
+static result_t measure(uint32_t min_ms, F fn) {
+  auto min = std::chrono::milliseconds(min_ms);
+  uint64_t frames = 0;
+  auto start = bench_clock::now();
+  auto elapsed = bench_clock::duration::zero();
+  // check the clock every few frames, not every frame: short strips take less than the clock read
+  for (uint64_t batch = 1; elapsed < min; batch *= 2) {
+    for (uint64_t i = 0; i < batch; i++) fn(frames++);
+    elapsed = bench_clock::now() - start;
+  }
+  return {frames, (double)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / frames};
+}
+
+// print_result prints a measurement. ns_per_led is left empty for stages that cost the same for any strip length.
+static void print_result(const char *effect, const char *format, uint32_t leds, const char *stage, result_t r,
+                         bool per_led = true) {
+  char ns_per_led[16] = "";
+  if (per_led) snprintf(ns_per_led, sizeof(ns_per_led), "%.3f", r.ns_per_frame / leds);
+  printf("%s,%s,%u,%s,%llu,%.1f,%s,%.3f\n", effect, format, leds, stage,
+         (unsigned long long)r.frames, r.ns_per_frame, ns_per_led, r.ns_per_frame * 100.0 / FRAME_NS);
+}
+
+// what Home Assistant sends for the light's controls (see on_command)
+static const struct {
+    const char *name;
+    const char *json;
+} COMMANDS[] = {
+    {"on", "{\"state\":\"ON\"}"},
+    {"off_transition", "{\"state\":\"OFF\",\"transition\":2}"},
+    {"brightness", "{\"state\":\"ON\",\"brightness\":50}"},
+    {"color", "{\"state\":\"ON\",\"color\":{\"h\":240.0,\"s\":73.333}}"},
+    {"effect", "{\"state\":\"ON\",\"effect\":\"white_chase:fast\"}"},
+    {"everything", "{\"state\":\"ON\",\"brightness\":100,\"color\":{\"h\":12.5,\"s\":100,\"x\":0.6,\"y\":0.3},"
+                   "\"effect\":\"hue_cycle:normal\",\"transition\":0.5,\"color_mode\":\"hs\"}"},
+};
+
+static int bench_command(uint32_t min_ms) {
+  printf("message,bytes,messages,ns_per_message,messages_per_sec\n");
+  for (auto &c : COMMANDS) {
+    size_t len = strlen(c.json);
+    command::command_t cmd;
+    auto r = measure(min_ms, [&](uint64_t) {
+      command::parse(c.json, len, &cmd);
+      sink = cmd.fields;
+    });
+    printf("%s,%zu,%llu,%.1f,%.0f\n", c.name, len, (unsigned long long)r.frames, r.ns_per_frame, 1e9 / r.ns_per_frame);
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "command") == 0) {
+    return bench_command(argc > 2 ? strtoul(argv[2], nullptr, 10) : 50);
+  }
+
+  uint32_t min_ms = argc > 1 ? strtoul(argv[1], nullptr, 10) : 50;
+
+  printf("effect,format,leds,stage,frames,ns_per_frame,ns_per_led,frame_pct\n");
+
+  for (auto &format : FORMATS) {
+    auto fns = effects::renderers(format.rgbw, format.order);
+
+    for (uint32_t leds : LED_COUNTS) {
+      auto *frame = new uint32_t[leds]();
+      auto *out = new uint32_t[leds]();
+      render::SineTable sine;
+
+      auto frame_at = [&](uint64_t n) {
+        sine.build(leds);
+        float t = (float)(n * 16) * DEFAULT_STATE.speed; // 60Hz worth of animation time per frame
+        return effects::frame_t{
+          .frame = frame,
+          .num_leds = leds,
+          .sine = &sine,
+          .p = render::frame_params(DEFAULT_STATE.hue, t / 200.0f, DEFAULT_STATE.angle, 1.0f),
+        };
+      };
+
+      for (uint8_t effect = 0; effect < effects::All::count; effect++) {
+        const char *name = effects::All::names[effect];
+
+        auto r = measure(min_ms, [&](uint64_t n) {
+          effects::All::render(fns, effect, frame_at(n));
+          sink = frame[n % leds];
+        });
+        print_result(name, format.name, leds, "render", r);
+
+        r = measure(min_ms, [&](uint64_t n) {
+          UNSPECIALISED[effect].render(frame_at(n), format.runtime);
+          sink = frame[n % leds];
+        });
+        print_result(UNSPECIALISED[effect].name, format.name, leds, "render", r);
+      }
+
+      // the output stages don't depend on the effect: once per format and length, on the last effect's frame
+      Renderer::snapshot_t snap = {};
+      snap.brightness = DEFAULT_STATE.brightness;
+      snap.transition_start_time = 1;
+      snap.transition_duration = 0xFFFFFFF0; // always mid-fade
+      snap.transition_start_brightness = 0.0f;
+      snap.transition_target_brightness = DEFAULT_STATE.brightness;
+      auto r = measure(min_ms, [&](uint64_t n) {
+        sink = render::brightness_scale(Renderer::effective_brightness(snap, 1 + (uint32_t)n * 16));
+      });
+      print_result("-", format.name, leds, "transition", r, false);
+
+      r = measure(min_ms, [&](uint64_t n) {
+        sink = render::scale_frame(frame, out, leds, 1 + (n & 0xFF));
+      });
+      print_result("-", format.name, leds, "brightness", r);
+
+      delete[] frame;
+      delete[] out;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,294 @@
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "hardware/timer.h"
+#include "sim.h"
+
+// Virtual clock and core1
+//
+// The clock only moves when core0 sleeps. core1 is a thread, and it only runs while core0 is blocked in a sleep that
+// passes core1's wake up time: core0 hands over, and waits until core1 is asleep again. So only one core ever runs at
+// a time, and a run is the same every time for the same script.
+
+static std::mutex &lock = *new std::mutex; // never destroyed, core1 is still waiting on them at exit
+static std::condition_variable &cv = *new std::condition_variable;
+static std::atomic<uint64_t> now_us{0};
+static bool core1_launched = false;
+static bool core1_asleep = false;
+static uint64_t core1_wake_us = 0;
+static thread_local uint core_num = 0;
+static bool sev_pending[2] = {}; // event register, per core
+
+// scheduled input changes, in time order
+static std::multimap<uint64_t, std::pair<uint, bool>> gpio_events;
+
+static void apply_gpio_events();
+
+absolute_time_t get_absolute_time() {
+  return now_us.load();
+}
+
+uint64_t time_us_64() {
+  return now_us.load();
+}
+
+uint get_core_num() {
+  return core_num;
+}
+
+static void core1_sleep_until(uint64_t t) {
+  std::unique_lock<std::mutex> l(lock);
+  core1_wake_us = t;
+  core1_asleep = true;
+  cv.notify_all();
+  cv.wait(l, [] { return !core1_asleep; });
+}
+
+// run_core1 lets core1 run until it's asleep again. call with lock held.
+static void run_core1(std::unique_lock<std::mutex> &l) {
+  core1_asleep = false;
+  cv.notify_all();
+  cv.wait(l, [] { return core1_asleep; });
+}
+
+static void core0_sleep_until(uint64_t t) {
+  while (true) {
+    {
+      std::unique_lock<std::mutex> l(lock);
+      uint64_t next = t;
+      if (core1_launched && core1_wake_us < next) next = core1_wake_us;
+      if (!gpio_events.empty() && gpio_events.begin()->first < next) next = gpio_events.begin()->first;
+      if (next > now_us.load()) now_us.store(next);
+
+      if (core1_launched && core1_wake_us <= now_us.load()) run_core1(l);
+    }
+    apply_gpio_events();
+
+    if (now_us.load() >= t) return;
+  }
+}
+
+void sleep_until(absolute_time_t t) {
+  if (t <= now_us.load()) return;
+  if (core_num == 1) {
+    core1_sleep_until(t);
+  } else {
+    core0_sleep_until(t);
+  }
+}
+
+// sev_core1 makes core1 run at the current time, to see the event. call with lock held.
+static void sev_core1() {
+  if (core1_launched && core1_wake_us > now_us.load()) core1_wake_us = now_us.load();
+}
+
+void multicore_launch_core1(void (*entry)(void)) {
+  std::unique_lock<std::mutex> l(lock);
+  core1_launched = true;
+  std::thread([entry] {
+    core_num = 1;
+    entry();
+  }).detach();
+  // up to its first sleep
+  cv.wait(l, [] { return core1_asleep; });
+}
+
+// GPIO
+
+static const uint NUM_GPIOS = 30;
+static bool gpio_levels[NUM_GPIOS];
+static uint32_t gpio_irq_masks[NUM_GPIOS];
+static gpio_irq_callback_t gpio_irq_callback = nullptr;
+
+void gpio_init(uint gpio) {}
+void gpio_set_dir(uint gpio, bool out) {}
+
+void gpio_put(uint gpio, bool value) {
+  if (gpio < NUM_GPIOS) gpio_levels[gpio] = value;
+}
+
+bool gpio_get(uint gpio) {
+  return gpio < NUM_GPIOS && gpio_levels[gpio];
+}
+
+void gpio_pull_up(uint gpio) {
+  gpio_put(gpio, true);
+}
+
+void gpio_pull_down(uint gpio) {
+  gpio_put(gpio, false);
+}
+
+void gpio_set_irq_enabled(uint gpio, uint32_t event_mask, bool enabled) {
+  if (gpio >= NUM_GPIOS) return;
+  if (enabled) {
+    gpio_irq_masks[gpio] |= event_mask;
+  } else {
+    gpio_irq_masks[gpio] &= ~event_mask;
+  }
+}
+
+void gpio_set_irq_enabled_with_callback(uint gpio, uint32_t event_mask, bool enabled, gpio_irq_callback_t callback) {
+  gpio_set_irq_enabled(gpio, event_mask, enabled);
+  gpio_irq_callback = callback;
+}
+
+void sim::schedule_gpio(uint64_t time_us, uint pin, bool level) {
+  gpio_events.emplace(time_us, std::make_pair(pin, level));
+  apply_gpio_events(); // if it's due now
+}
+
+bool sim::gpio_level(uint pin) {
+  return gpio_get(pin);
+}
+
+static void apply_gpio_events() {
+  while (!gpio_events.empty() && gpio_events.begin()->first <= now_us.load()) {
+    auto ev = gpio_events.begin()->second;
+    gpio_events.erase(gpio_events.begin());
+
+    uint pin = ev.first;
+    if (pin >= NUM_GPIOS || gpio_levels[pin] == ev.second) continue;
+    gpio_levels[pin] = ev.second;
+
+    uint32_t event = ev.second ? GPIO_IRQ_EDGE_RISE : GPIO_IRQ_EDGE_FALL;
+    if (gpio_irq_callback && (gpio_irq_masks[pin] & event)) gpio_irq_callback(pin, event);
+  }
+}
+
+// Hardware alarms and WFE/SEV
+
+typedef struct {
+    bool claimed;
+    uint core;
+    hardware_alarm_callback_t callback;
+    bool armed;
+    uint64_t target;
+} alarm_t;
+static alarm_t alarms[NUM_TIMERS];
+
+int hardware_alarm_claim_unused(bool required) {
+  for (int i = 0; i < NUM_TIMERS; i++) {
+    if (alarms[i].claimed) continue;
+    alarms[i].claimed = true;
+    return i;
+  }
+  return -1;
+}
+
+void hardware_alarm_set_callback(uint alarm_num, hardware_alarm_callback_t callback) {
+  alarms[alarm_num].callback = callback;
+  alarms[alarm_num].core = core_num;
+}
+
+bool hardware_alarm_set_target(uint alarm_num, absolute_time_t t) {
+  if (t <= now_us.load()) return true;
+  alarms[alarm_num].target = t;
+  alarms[alarm_num].armed = true;
+  return false;
+}
+
+void hardware_alarm_cancel(uint alarm_num) {
+  alarms[alarm_num].armed = false;
+}
+
+// next_alarm returns the earliest armed alarm target of this core, or UINT64_MAX
+static uint64_t next_alarm() {
+  uint64_t t = UINT64_MAX;
+  for (auto &a : alarms) {
+    if (a.armed && a.core == core_num && a.target < t) t = a.target;
+  }
+  return t;
+}
+
+static void fire_alarms() {
+  for (uint i = 0; i < NUM_TIMERS; i++) {
+    auto &a = alarms[i];
+    if (!a.armed || a.core != core_num || a.target > now_us.load()) continue;
+    a.armed = false;
+    if (a.callback) a.callback(i);
+    sev_pending[core_num] = true; // IRQ exit sets the event register
+  }
+}
+
+void __sev() {
+  std::unique_lock<std::mutex> l(lock);
+  sev_pending[0] = sev_pending[1] = true;
+  sev_core1();
+}
+
+void __wfe() {
+  {
+    std::unique_lock<std::mutex> l(lock);
+    if (sev_pending[core_num]) {
+      sev_pending[core_num] = false;
+      return;
+    }
+  }
+
+  uint64_t t = next_alarm();
+  if (core_num == 0 && !gpio_events.empty() && gpio_events.begin()->first < t) t = gpio_events.begin()->first;
+  if (t == UINT64_MAX) t = now_us.load() + 1000; // nothing will ever wake us, don't hang
+
+  sleep_until(t);
+  fire_alarms();
+
+  std::unique_lock<std::mutex> l(lock);
+  sev_pending[core_num] = false;
+}
+
+// Flash
+
+uint8_t _sim_flash[PICO_FLASH_SIZE_BYTES];
+static bool flash_initialized = false;
+
+static void flash_init() {
+  if (flash_initialized) return;
+  memset(_sim_flash, 0xff, sizeof(_sim_flash));
+  flash_initialized = true;
+}
+
+// erased before anything reads it through XIP_BASE
+static struct flash_init_t {
+    flash_init_t() { flash_init(); }
+} _flash_init;
+
+void flash_range_erase(uint32_t flash_offs, size_t count) {
+  flash_init();
+  // whole sectors, like the real thing
+  uint32_t start = flash_offs & ~(FLASH_SECTOR_SIZE - 1);
+  uint32_t end = (flash_offs + count + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+  if (end > sizeof(_sim_flash)) end = sizeof(_sim_flash);
+  if (start < end) memset(_sim_flash + start, 0xff, end - start);
+}
+
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count) {
+  flash_init();
+  // programming can only clear bits
+  for (size_t i = 0; i < count && flash_offs + i < sizeof(_sim_flash); i++) _sim_flash[flash_offs + i] &= data[i];
+}
+
+int sim::load_flash(const char *path) {
+  flash_init();
+  FILE *f = fopen(path, "rb");
+  if (f == nullptr) return -1;
+  size_t n = fread(_sim_flash, 1, sizeof(_sim_flash), f);
+  fclose(f);
+  return n == sizeof(_sim_flash) ? 0 : -2;
+}
+
+int sim::save_flash(const char *path) {
+  flash_init();
+  FILE *f = fopen(path, "wb");
+  if (f == nullptr) return -1;
+  size_t n = fwrite(_sim_flash, 1, sizeof(_sim_flash), f);
+  fclose(f);
+  return n == sizeof(_sim_flash) ? 0 : -2;
+}
@@ -0,0 +1,65 @@
+#pragma once
+// Host simulator: pimoroni-pico's Button, on the fake GPIOs
+
+#include <cstdint>
+#include "pico/stdlib.h"
+#include "common/pimoroni_common.hpp"
+
+namespace pimoroni {
+
+  class Button {
+    public:
+      Button(uint pin, Polarity polarity=Polarity::ACTIVE_LOW, uint32_t repeat_time=200, uint32_t hold_time=1000) :
+        pin(pin), polarity(polarity), repeat_time(repeat_time), hold_time(hold_time) {
+        gpio_init(pin);
+        gpio_set_dir(pin, GPIO_IN);
+        if (polarity == Polarity::ACTIVE_LOW) {
+          gpio_pull_up(pin);
+        } else {
+          gpio_pull_down(pin);
+        }
+      }
+
+      bool raw() {
+        return polarity == Polarity::ACTIVE_LOW ? !gpio_get(pin) : gpio_get(pin);
+      }
+
+      // read returns true once per press, and then every repeat_time while held (faster after hold_time)
+      bool read() {
+        uint32_t time = to_ms_since_boot(get_absolute_time());
+        bool state = raw();
+        bool changed = state != last_state;
+        last_state = state;
+
+        if (changed) {
+          if (state) {
+            pressed_time = time;
+            pressed = true;
+            last_time = time;
+            return true;
+          }
+          pressed = false;
+          last_time = 0;
+        }
+
+        if (repeat_time == 0 || !pressed) return false;
+        uint32_t repeat_rate = repeat_time;
+        if (hold_time > 0 && time - pressed_time > hold_time) repeat_rate /= 3;
+        if (time - last_time > repeat_rate) {
+          last_time = time;
+          return true;
+        }
+        return false;
+      }
+
+    private:
+      uint pin;
+      Polarity polarity;
+      uint32_t repeat_time;
+      uint32_t hold_time;
+      bool pressed = false;
+      bool last_state = false;
+      uint32_t pressed_time = 0;
+      uint32_t last_time = 0;
+  };
+}
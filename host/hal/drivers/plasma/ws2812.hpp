@@ -0,0 +1,19 @@
+#pragma once
+// Host simulator: the parts of pimoroni-pico's plasma::WS2812 that ledcontrol uses (the colour order)
+
+#include "pico/types.h"
+
+namespace plasma {
+  class WS2812 {
+    public:
+      static const uint DEFAULT_SERIAL_FREQ = 800000;
+      enum class COLOR_ORDER {
+        RGB,
+        RBG,
+        GRB,
+        GBR,
+        BRG,
+        BGR
+      };
+  };
+}
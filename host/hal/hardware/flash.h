@@ -0,0 +1,12 @@
+#pragma once
+// Host simulator: flash is an in-memory array (see sim.h to load/save it), mapped at XIP_BASE
+
+#include <cstdint>
+#include <cstddef>
+
+#define FLASH_PAGE_SIZE (1u << 8)
+#define FLASH_SECTOR_SIZE (1u << 12)
+#define PICO_FLASH_SIZE_BYTES (2 * 1024 * 1024)
+
+void flash_range_erase(uint32_t flash_offs, size_t count);
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count);
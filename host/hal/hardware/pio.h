@@ -0,0 +1,8 @@
+#pragma once
+// Host simulator: only the PIO type, the LED strip is captured instead (see ledstrip.cpp)
+
+typedef struct pio_hw pio_hw_t;
+typedef pio_hw_t *PIO;
+
+#define pio0 ((PIO)nullptr)
+#define pio1 ((PIO)nullptr)
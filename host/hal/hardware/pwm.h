@@ -0,0 +1,12 @@
+#pragma once
+// Host simulator: PWM is only used for the encoder LED, which isn't simulated
+
+#include <cstdint>
+#include "pico/types.h"
+
+static inline uint pwm_gpio_to_slice_num(uint gpio) { return (gpio >> 1) & 7; }
+static inline uint pwm_gpio_to_channel(uint gpio) { return gpio & 1; }
+static inline void pwm_set_clkdiv_int_frac(uint slice_num, uint8_t integer, uint8_t fract) {}
+static inline void pwm_set_wrap(uint slice_num, uint16_t wrap) {}
+static inline void pwm_set_chan_level(uint slice_num, uint chan, uint16_t level) {}
+static inline void pwm_set_enabled(uint slice_num, bool enabled) {}
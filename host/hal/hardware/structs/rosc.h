@@ -0,0 +1,14 @@
+#pragma once
+// Host simulator: the ring oscillator's random bit, a fresh one for every read
+
+#include <cstdint>
+#include <cstdlib>
+
+typedef struct {
+    struct {
+        operator uint32_t() const { return (uint32_t)rand() & 1; }
+    } randombit;
+} rosc_hw_t;
+
+static rosc_hw_t _sim_rosc;
+#define rosc_hw (&_sim_rosc)
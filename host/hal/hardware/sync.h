@@ -0,0 +1,12 @@
+#pragma once
+// Host simulator: the cores never run at the same time (see hal.cpp), so there's nothing to disable. WFE/SEV are
+// implemented on the virtual clock.
+
+#include <cstdint>
+
+static inline uint32_t save_and_disable_interrupts() { return 0; }
+static inline void restore_interrupts(uint32_t status) {}
+
+// __wfe sleeps until the next alarm or input event for this core, or returns right away after a __sev
+void __wfe();
+void __sev();
@@ -0,0 +1,14 @@
+#pragma once
+// Host simulator: hardware alarms on the virtual clock. Callbacks run on the core that set them, from __wfe().
+
+#include "pico/stdlib.h"
+
+#define NUM_TIMERS 4
+
+typedef void (*hardware_alarm_callback_t)(uint alarm_num);
+
+int hardware_alarm_claim_unused(bool required);
+void hardware_alarm_set_callback(uint alarm_num, hardware_alarm_callback_t callback);
+// returns true if t has already passed (and the alarm isn't set)
+bool hardware_alarm_set_target(uint alarm_num, absolute_time_t t);
+void hardware_alarm_cancel(uint alarm_num);
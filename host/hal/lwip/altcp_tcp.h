@@ -0,0 +1,4 @@
+#pragma once
+// Host simulator: MQTT runs over the host's sockets, with TLS if the client info has a config, see lwip/apps/mqtt.h
+
+#include "lwip/err.h"
@@ -0,0 +1,24 @@
+#pragma once
+// Host simulator: lwIP's TLS layer (altcp_tls_mbedtls) on OpenSSL, see net.cpp. Like the Pico's mbedtls, it only
+// speaks TLS 1.2 and checks the broker's certificate chain against the configured one, not its name.
+
+#include <cstddef>
+#include "lwip/err.h"
+
+struct altcp_pcb;
+struct altcp_tls_config;
+struct altcp_tls_session;
+
+// cert: PEM, NULL to skip verification
+struct altcp_tls_config *altcp_tls_create_config_client(const u8_t *cert, size_t cert_len);
+struct altcp_tls_config *altcp_tls_create_config_client_2wayauth(const u8_t *ca, size_t ca_len, const u8_t *privkey,
+                                                                 size_t privkey_len, const u8_t *privkey_pass,
+                                                                 size_t privkey_pass_len, const u8_t *cert,
+                                                                 size_t cert_len);
+void altcp_tls_free_config(struct altcp_tls_config *conf);
+
+struct altcp_tls_session *altcp_tls_alloc_session(void);
+// get_session fails until the handshake is done; set_session must be called before it starts
+err_t altcp_tls_get_session(struct altcp_pcb *conn, struct altcp_tls_session *dest);
+err_t altcp_tls_set_session(struct altcp_pcb *conn, struct altcp_tls_session *from);
+void altcp_tls_free_session(struct altcp_tls_session *dest);
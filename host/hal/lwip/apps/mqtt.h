@@ -0,0 +1,63 @@
+#pragma once
+// Host simulator: lwIP's MQTT client API, over POSIX sockets (see net.cpp). It behaves like lwIP's as far as the
+// firmware can tell:
+//  - callbacks only run from cyw43_arch_poll(), never from inside an API call
+//  - a connection that fails or is lost calls the connection callback with MQTT_CONNECT_DISCONNECTED (or
+//    MQTT_CONNECT_TIMEOUT for keepalive), one closed with mqtt_disconnect() doesn't
+//  - requests of a closed connection are dropped without calling back
+//  - QoS 0 publishes complete when they're written to the socket, QoS 1 and 2 when the broker acknowledges them
+//  - incoming payloads are handed over in pieces of at most MQTT_VAR_HEADER_BUFFER_LEN bytes
+
+#include "lwip/err.h"
+#include "lwip/ip_addr.h"
+
+#define MQTT_VAR_HEADER_BUFFER_LEN 128
+#define MQTT_REQ_MAX_IN_FLIGHT 4
+#define MQTT_OUTPUT_RINGBUF_SIZE 16384 // as in lwipopts.h
+
+typedef struct mqtt_client_s mqtt_client_t;
+
+typedef enum {
+    MQTT_CONNECT_ACCEPTED = 0,
+    MQTT_CONNECT_REFUSED_PROTOCOL_VERSION = 1,
+    MQTT_CONNECT_REFUSED_IDENTIFIER = 2,
+    MQTT_CONNECT_REFUSED_SERVER = 3,
+    MQTT_CONNECT_REFUSED_USERNAME_PASS = 4,
+    MQTT_CONNECT_REFUSED_NOT_AUTHORIZED_ = 5,
+    MQTT_CONNECT_DISCONNECTED = 256,
+    MQTT_CONNECT_TIMEOUT = 257,
+} mqtt_connection_status_t;
+
+enum {
+    MQTT_DATA_FLAG_LAST = 1,
+};
+
+typedef void (*mqtt_connection_cb_t)(mqtt_client_t *client, void *arg, mqtt_connection_status_t status);
+typedef void (*mqtt_incoming_publish_cb_t)(void *arg, const char *topic, u32_t tot_len);
+typedef void (*mqtt_incoming_data_cb_t)(void *arg, const u8_t *data, u16_t len, u8_t flags);
+typedef void (*mqtt_request_cb_t)(void *arg, err_t err);
+
+struct mqtt_connect_client_info_t {
+    const char *client_id;
+    const char *client_user;
+    const char *client_pass;
+    u16_t keep_alive; // seconds
+    const char *will_topic;
+    const char *will_msg;
+    u8_t will_qos;
+    u8_t will_retain;
+    struct altcp_tls_config *tls_config; // NULL: no TLS
+};
+
+mqtt_client_t *mqtt_client_new(void);
+void mqtt_client_free(mqtt_client_t *client);
+err_t mqtt_client_connect(mqtt_client_t *client, const ip_addr_t *ipaddr, u16_t port, mqtt_connection_cb_t cb,
+                          void *arg, const struct mqtt_connect_client_info_t *client_info);
+void mqtt_disconnect(mqtt_client_t *client);
+u8_t mqtt_client_is_connected(mqtt_client_t *client);
+void mqtt_set_inpub_callback(mqtt_client_t *client, mqtt_incoming_publish_cb_t pub_cb,
+                             mqtt_incoming_data_cb_t data_cb, void *arg);
+err_t mqtt_subscribe(mqtt_client_t *client, const char *topic, u8_t qos, mqtt_request_cb_t cb, void *arg);
+err_t mqtt_unsubscribe(mqtt_client_t *client, const char *topic, mqtt_request_cb_t cb, void *arg);
+err_t mqtt_publish(mqtt_client_t *client, const char *topic, const void *payload, u16_t payload_length, u8_t qos,
+                   u8_t retain, mqtt_request_cb_t cb, void *arg);
@@ -0,0 +1,41 @@
+#pragma once
+// Host simulator: the MQTT client's state, see net.cpp. conn is the connection, as in lwIP: the TLS session calls take
+// it.
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "lwip/apps/mqtt.h"
+
+struct altcp_pcb;
+
+typedef struct {
+    uint16_t id; // 0 for QoS 0 publishes
+    uint64_t done_at; // QoS 0: complete once this many bytes were written
+    uint64_t time_us;
+    mqtt_request_cb_t cb;
+    void *arg;
+} mqtt_request_t;
+
+struct mqtt_client_s {
+    enum STATE : uint8_t {
+        DISCONNECTED,
+        TCP_CONNECTING,
+        TLS_HANDSHAKE,
+        MQTT_CONNECTING, // CONNECT sent, waiting for CONNACK
+        CONNECTED,
+    } state = DISCONNECTED;
+    struct altcp_pcb *conn = nullptr;
+    bool failed = false; // the TCP connect failed right away, reported from the next poll
+    mqtt_connection_cb_t connect_cb = nullptr;
+    void *connect_arg = nullptr;
+    mqtt_incoming_publish_cb_t pub_cb = nullptr;
+    mqtt_incoming_data_cb_t data_cb = nullptr;
+    void *inpub_arg = nullptr;
+    uint16_t keep_alive = 0; // s
+    uint64_t connect_us = 0, last_rx_us = 0, last_tx_us = 0;
+    std::string out, in; // not written yet, not parsed yet
+    uint64_t queued = 0, written = 0; // bytes, ever
+    uint16_t next_id = 1;
+    std::vector<mqtt_request_t> requests;
+};
@@ -0,0 +1,7 @@
+#pragma once
+// Host simulator: DHCP "binds" as soon as the link is up, see cyw43_arch.h
+
+#include "lwip/netif.h"
+
+void dhcp_stop(struct netif *netif);
+u8_t dhcp_supplied_address(const struct netif *netif);
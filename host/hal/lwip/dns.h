@@ -0,0 +1,12 @@
+#pragma once
+// Host simulator: lookups go to the host's resolver. A name that resolves is answered right away (ERR_OK), like from
+// lwIP's cache. One that doesn't is reported to the callback from the next cyw43_arch_poll().
+
+#include "lwip/err.h"
+#include "lwip/ip_addr.h"
+
+typedef void (*dns_found_callback)(const char *name, const ip_addr_t *ipaddr, void *callback_arg);
+
+err_t dns_gethostbyname(const char *hostname, ip_addr_t *addr, dns_found_callback found, void *callback_arg);
+void dns_setserver(u8_t numdns, const ip_addr_t *dnsserver);
+const ip_addr_t *dns_getserver(u8_t numdns);
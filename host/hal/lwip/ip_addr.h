@@ -0,0 +1,16 @@
+#pragma once
+// Host simulator: IPv4 only lwIP addresses, in network byte order like lwIP's
+
+#include "lwip/arch.h"
+
+typedef struct ip4_addr {
+    u32_t addr;
+} ip4_addr_t;
+typedef ip4_addr_t ip_addr_t;
+
+#define ip4_addr_set_u32(dest, src) ((dest)->addr = (src))
+#define ip4_addr_get_u32(src) ((src)->addr)
+
+int ip4addr_aton(const char *cp, ip4_addr_t *addr);
+// ip4addr_ntoa returns a static buffer, overwritten by the next call
+char *ip4addr_ntoa(const ip4_addr_t *addr);
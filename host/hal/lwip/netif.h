@@ -0,0 +1,15 @@
+#pragma once
+// Host simulator: the interface is the host's, so its address is only what the fake DHCP (or the firmware) set
+
+#include "lwip/ip_addr.h"
+
+struct netif {
+    ip4_addr_t ip_addr, netmask, gw;
+    bool dhcp_bound;
+};
+
+#define netif_ip4_addr(n) ((const ip4_addr_t *)&(n)->ip_addr)
+#define netif_ip4_netmask(n) ((const ip4_addr_t *)&(n)->netmask)
+#define netif_ip4_gw(n) ((const ip4_addr_t *)&(n)->gw)
+
+void netif_set_addr(struct netif *netif, const ip4_addr_t *ipaddr, const ip4_addr_t *netmask, const ip4_addr_t *gw);
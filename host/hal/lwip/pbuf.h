@@ -0,0 +1,4 @@
+#pragma once
+// Host simulator: nothing ledcontrol uses directly
+
+#include "lwip/arch.h"
@@ -0,0 +1,10 @@
+#pragma once
+// Host simulator: the cores never run at the same time (see hal.cpp), so critical sections are no-ops
+
+typedef struct {
+  int unused;
+} critical_section_t;
+
+static inline void critical_section_init(critical_section_t *crit_sec) {}
+static inline void critical_section_enter_blocking(critical_section_t *crit_sec) {}
+static inline void critical_section_exit(critical_section_t *crit_sec) {}
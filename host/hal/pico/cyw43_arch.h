@@ -0,0 +1,43 @@
+#pragma once
+// Host simulator: the WiFi chip in poll mode. Joining the access point (see sim.h) works right away, with a DHCP lease;
+// a join straight to a BSSID it doesn't have never finishes. cyw43_arch_poll() is where the fake lwIP does its socket
+// I/O and runs its callbacks, as the real one does in poll mode.
+
+#include <cstddef>
+#include <cstdint>
+#include "lwip/netif.h"
+
+#define CYW43_ITF_STA 0
+#define CYW43_ITF_AP 1
+
+#define CYW43_LINK_DOWN 0
+#define CYW43_LINK_JOIN 1
+#define CYW43_LINK_NOIP 2
+#define CYW43_LINK_UP 3
+#define CYW43_LINK_FAIL (-1)
+#define CYW43_LINK_NONET (-2)
+#define CYW43_LINK_BADAUTH (-3)
+
+#define CYW43_AUTH_OPEN 0
+#define CYW43_AUTH_WPA2_AES_PSK 0x00400004
+
+#define CYW43_IOCTL_GET_CHANNEL 0x56
+
+typedef struct {
+    struct netif netif[2];
+} cyw43_t;
+
+extern cyw43_t cyw43_state;
+
+static inline int cyw43_arch_init() { return 0; }
+static inline void cyw43_arch_enable_sta_mode() {}
+static inline void cyw43_arch_lwip_begin() {}
+static inline void cyw43_arch_lwip_end() {}
+void cyw43_arch_poll();
+
+int cyw43_arch_wifi_connect_async(const char *ssid, const char *pw, uint32_t auth);
+int cyw43_wifi_join(cyw43_t *self, size_t ssid_len, const uint8_t *ssid, size_t key_len, const uint8_t *key,
+                    uint32_t auth_type, const uint8_t *bssid, uint32_t channel);
+int cyw43_tcpip_link_status(cyw43_t *self, int itf);
+int cyw43_wifi_get_bssid(cyw43_t *self, uint8_t bssid[6]);
+int cyw43_ioctl(cyw43_t *self, uint32_t cmd, size_t len, uint8_t *buf, uint32_t iface);
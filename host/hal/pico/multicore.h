@@ -0,0 +1,10 @@
+#pragma once
+// Host simulator: core1 is a thread, run in lockstep with core0 on the virtual clock (see hal.cpp)
+
+#include "pico/types.h"
+
+void multicore_launch_core1(void (*entry)(void));
+uint get_core_num();
+static inline void multicore_lockout_victim_init() {}
+static inline void multicore_lockout_start_blocking() {}
+static inline void multicore_lockout_end_blocking() {}
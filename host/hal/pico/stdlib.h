@@ -0,0 +1,32 @@
+#pragma once
+// Host simulator: the Pico SDK time and GPIO functions ledcontrol uses, on the virtual clock and fake GPIOs in hal.cpp.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include "pico/types.h"
+#include "hardware/gpio.h"
+
+#define PICO_DEFAULT_LED_PIN 25
+#define XIP_BASE ((uintptr_t)_sim_flash)
+extern uint8_t _sim_flash[];
+
+absolute_time_t get_absolute_time();
+uint64_t time_us_64();
+static inline uint32_t time_us_32() { return (uint32_t)time_us_64(); }
+static inline uint32_t to_ms_since_boot(absolute_time_t t) { return (uint32_t)(t / 1000); }
+static inline uint64_t to_us_since_boot(absolute_time_t t) { return t; }
+static inline absolute_time_t delayed_by_us(absolute_time_t t, uint64_t us) { return t + us; }
+static inline absolute_time_t delayed_by_ms(absolute_time_t t, uint32_t ms) { return t + (uint64_t)ms * 1000; }
+static inline absolute_time_t make_timeout_time_ms(uint32_t ms) { return delayed_by_ms(get_absolute_time(), ms); }
+static inline int64_t absolute_time_diff_us(absolute_time_t from, absolute_time_t to) { return (int64_t)(to - from); }
+
+// sleeping on core0 moves the virtual clock, on core1 it waits for core0 to get there
+void sleep_until(absolute_time_t t);
+static inline void sleep_us(uint64_t us) { sleep_until(delayed_by_us(get_absolute_time(), us)); }
+static inline void sleep_ms(uint32_t ms) { sleep_until(delayed_by_ms(get_absolute_time(), ms)); }
+static inline void busy_wait_us_32(uint32_t us) { sleep_us(us); }
+static inline void tight_loop_contents() {}
+
+static inline bool stdio_init_all() { return true; }
+static inline absolute_time_t from_us_since_boot(uint64_t us) { return us; }
@@ -0,0 +1,8 @@
+#pragma once
+// Host simulator: newlib gives the firmware `uint` through <stdio.h>, glibc doesn't always. Force included.
+
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef unsigned int uint;
+typedef uint64_t absolute_time_t;
@@ -0,0 +1,9 @@
+#pragma once
+// Host simulator: a fixed board id
+
+#include <cstdio>
+#include "pico/types.h"
+
+static inline void pico_get_unique_board_id_string(char *id_out, uint len) {
+  snprintf(id_out, len, "%s", "E6614103E7452D2F");
+}
@@ -0,0 +1,62 @@
+#include "ledstrip.h"
+#include <algorithm>
+#include "sim.h"
+
+// Host simulator LEDStrip: same interface, but frames are captured to memory (see sim::frames()) instead of sent. A
+// frame is taken as sent the moment it's presented, so the strip is always ready.
+
+using namespace ledcontrol;
+
+static std::vector<sim::frame_t> captured;
+
+void sim::capture_frame(const uint32_t *pixels, uint32_t num_leds) {
+  captured.push_back({time_us_64(), std::vector<uint32_t>(pixels, pixels + num_leds)});
+}
+
+const std::vector<sim::frame_t> &sim::frames() {
+  return captured;
+}
+
+LEDStrip::LEDStrip(uint p_num_leds, PIO p_pio, uint p_pin, bool p_rgbw, uint p_strips, uint p_freq):
+    num_leds(p_num_leds),
+    strips(std::min(std::max(p_strips, 1u), MAX_STRIPS)),
+    leds_per_strip((p_num_leds + strips - 1) / strips),
+    pio(p_pio),
+    pin(p_pin),
+    rgbw(p_rgbw),
+    freq(p_freq),
+    front(0),
+    transmitting(false),
+    pending(false)
+{
+  bits = rgbw ? 32 : 24;
+  words = num_leds;
+  buffers[0] = new uint32_t[num_leds]();
+  buffers[1] = new uint32_t[num_leds]();
+  critical_section_init(&cs);
+}
+
+void LEDStrip::init() {
+}
+
+void LEDStrip::present() {
+  front ^= 1;
+  sim::capture_frame(buffers[front], num_leds);
+}
+
+void LEDStrip::wait() {
+}
+
+uint32_t LEDStrip::frame_time_us() const {
+  return (uint32_t)((uint64_t)leds_per_strip * bits * 1000000 / freq) + RESET_TIME_US;
+}
+
+void LEDStrip::start_transmit() {
+}
+
+void LEDStrip::_dma_irq_handler() {
+}
+
+int64_t LEDStrip::_transmit_done() {
+  return 0;
+}
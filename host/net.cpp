@@ -0,0 +1,692 @@
+#include <arpa/inet.h>
+#include <cerrno>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <csignal>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+
+#include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"
+#include "lwip/dns.h"
+#include "lwip/dhcp.h"
+#include "lwip/altcp_tls.h"
+#include "lwip/apps/mqtt.h"
+#include "lwip/apps/mqtt_priv.h"
+#include "sim.h"
+
+// Host network: the WiFi chip, DHCP, DNS and lwIP's MQTT client (with TLS, on OpenSSL), on the host's sockets.
+// Everything runs on core0, in the calls the firmware makes and in cyw43_arch_poll(), like lwIP in poll mode. Timeouts
+// are on the virtual clock.
+
+cyw43_t cyw43_state;
+
+// WiFi and DHCP: there's one access point, see sim::set_access_point. Joining it takes no time, and neither does the
+// lease (the loopback address). A join to another BSSID or channel gets no answer: the link stays CYW43_LINK_JOIN.
+
+static uint8_t ap_bssid[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+static uint32_t ap_channel = 6;
+static int link_status = CYW43_LINK_DOWN;
+static std::vector<sim::wifi_join_t> wifi_joins;
+static bool dhcp_stopped = false;
+
+void sim::set_access_point(const uint8_t bssid[6], uint32_t channel) {
+  memcpy(ap_bssid, bssid, sizeof(ap_bssid));
+  ap_channel = channel;
+}
+
+const std::vector<sim::wifi_join_t> &sim::joins() {
+  return wifi_joins;
+}
+
+static int join(const uint8_t *bssid, uint32_t channel) {
+  sim::wifi_join_t j = {time_us_64(), bssid != nullptr, {}, channel};
+  if (bssid != nullptr) memcpy(j.bssid, bssid, sizeof(j.bssid));
+  wifi_joins.push_back(j);
+  if (bssid != nullptr && (memcmp(bssid, ap_bssid, sizeof(ap_bssid)) != 0 || channel != ap_channel)) {
+    link_status = CYW43_LINK_JOIN;
+    return 0;
+  }
+
+  link_status = CYW43_LINK_UP;
+  auto &n = cyw43_state.netif[CYW43_ITF_STA];
+  if (!dhcp_stopped && !n.dhcp_bound) {
+    ip4addr_aton("127.0.0.1", &n.ip_addr);
+    ip4addr_aton("255.0.0.0", &n.netmask);
+    ip4addr_aton("127.0.0.1", &n.gw);
+    n.dhcp_bound = true;
+  }
+  return 0;
+}
+
+int cyw43_arch_wifi_connect_async(const char *ssid, const char *pw, uint32_t auth) {
+  return join(nullptr, 0);
+}
+
+int cyw43_wifi_join(cyw43_t *self, size_t ssid_len, const uint8_t *ssid, size_t key_len, const uint8_t *key,
+                    uint32_t auth_type, const uint8_t *bssid, uint32_t channel) {
+  return join(bssid, channel);
+}
+
+int cyw43_tcpip_link_status(cyw43_t *self, int itf) {
+  if (link_status != CYW43_LINK_UP) return link_status;
+  return self->netif[itf].ip_addr.addr != 0 ? CYW43_LINK_UP : CYW43_LINK_NOIP;
+}
+
+int cyw43_wifi_get_bssid(cyw43_t *self, uint8_t bssid[6]) {
+  memcpy(bssid, ap_bssid, sizeof(ap_bssid));
+  return 0;
+}
+
+int cyw43_ioctl(cyw43_t *self, uint32_t cmd, size_t len, uint8_t *buf, uint32_t iface) {
+  if (cmd == CYW43_IOCTL_GET_CHANNEL && len >= sizeof(uint32_t)) memcpy(buf, &ap_channel, sizeof(ap_channel));
+  return 0;
+}
+
+void netif_set_addr(struct netif *netif, const ip4_addr_t *ipaddr, const ip4_addr_t *netmask, const ip4_addr_t *gw) {
+  netif->ip_addr = *ipaddr;
+  netif->netmask = *netmask;
+  netif->gw = *gw;
+}
+
+void dhcp_stop(struct netif *netif) {
+  dhcp_stopped = true;
+  netif->dhcp_bound = false;
+}
+
+u8_t dhcp_supplied_address(const struct netif *netif) {
+  return netif->dhcp_bound;
+}
+
+// addresses
+
+int ip4addr_aton(const char *cp, ip4_addr_t *addr) {
+  in_addr a;
+  if (inet_pton(AF_INET, cp, &a) != 1) return 0;
+  addr->addr = a.s_addr;
+  return 1;
+}
+
+char *ip4addr_ntoa(const ip4_addr_t *addr) {
+  static char buf[INET_ADDRSTRLEN];
+  in_addr a = {addr->addr};
+  inet_ntop(AF_INET, &a, buf, sizeof(buf));
+  return buf;
+}
+
+// DNS
+
+static ip_addr_t dns_servers[2];
+
+typedef struct {
+    std::string name;
+    dns_found_callback found;
+    void *arg;
+} lookup_t;
+static std::vector<lookup_t> failed_lookups; // reported from the next poll
+static uint32_t lookups = 0;
+
+uint32_t sim::dns_lookups() {
+  return lookups;
+}
+
+err_t dns_gethostbyname(const char *hostname, ip_addr_t *addr, dns_found_callback found, void *callback_arg) {
+  if (ip4addr_aton(hostname, addr)) return ERR_OK;
+  lookups++;
+
+  addrinfo hints = {};
+  hints.ai_family = AF_INET;
+  addrinfo *res;
+  if (getaddrinfo(hostname, nullptr, &hints, &res) == 0) {
+    addr->addr = ((sockaddr_in *)res->ai_addr)->sin_addr.s_addr;
+    freeaddrinfo(res);
+    return ERR_OK;
+  }
+  failed_lookups.push_back({hostname, found, callback_arg});
+  return ERR_INPROGRESS;
+}
+
+void dns_setserver(u8_t numdns, const ip_addr_t *dnsserver) {
+  if (numdns < 2) dns_servers[numdns] = *dnsserver;
+}
+
+const ip_addr_t *dns_getserver(u8_t numdns) {
+  return &dns_servers[numdns < 2 ? numdns : 0];
+}
+
+// TLS, see lwip/altcp_tls.h
+
+struct altcp_tls_config {
+    SSL_CTX *ctx;
+};
+
+struct altcp_tls_session {
+    SSL_SESSION *session;
+};
+
+// altcp_pcb is a connection: its socket, and its TLS state if it has a config
+struct altcp_pcb {
+    int fd;
+    SSL *ssl;
+};
+
+static struct altcp_tls_config *new_config(const u8_t *ca, size_t ca_len) {
+  SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+  if (ctx == nullptr) return nullptr;
+  SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+  SSL_CTX_set_max_proto_version(ctx, TLS1_2_VERSION);
+  if (ca == nullptr) {
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, nullptr);
+    return new altcp_tls_config{ctx};
+  }
+
+  // every certificate in the PEM is trusted
+  BIO *bio = BIO_new_mem_buf(ca, (int)ca_len);
+  X509_STORE *store = SSL_CTX_get_cert_store(ctx);
+  int n = 0;
+  for (X509 *x; (x = PEM_read_bio_X509(bio, nullptr, nullptr, nullptr)) != nullptr; n++) {
+    X509_STORE_add_cert(store, x);
+    X509_free(x);
+  }
+  BIO_free(bio);
+  ERR_clear_error(); // reading past the last one
+  if (n == 0) {
+    SSL_CTX_free(ctx);
+    return nullptr;
+  }
+  SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
+  return new altcp_tls_config{ctx};
+}
+
+struct altcp_tls_config *altcp_tls_create_config_client(const u8_t *cert, size_t cert_len) {
+  return new_config(cert, cert_len);
+}
+
+struct altcp_tls_config *altcp_tls_create_config_client_2wayauth(const u8_t *ca, size_t ca_len, const u8_t *privkey,
+                                                                 size_t privkey_len, const u8_t *privkey_pass,
+                                                                 size_t privkey_pass_len, const u8_t *cert,
+                                                                 size_t cert_len) {
+  auto conf = new_config(ca, ca_len);
+  if (conf == nullptr) return nullptr;
+
+  BIO *bio = BIO_new_mem_buf(cert, (int)cert_len);
+  X509 *x = PEM_read_bio_X509(bio, nullptr, nullptr, nullptr);
+  BIO_free(bio);
+  std::string pass((const char *)privkey_pass, privkey_pass_len);
+  bio = BIO_new_mem_buf(privkey, (int)privkey_len);
+  EVP_PKEY *key = PEM_read_bio_PrivateKey(bio, nullptr, nullptr, (void *)pass.c_str());
+  BIO_free(bio);
+
+  bool ok = x != nullptr && key != nullptr && SSL_CTX_use_certificate(conf->ctx, x) == 1 &&
+            SSL_CTX_use_PrivateKey(conf->ctx, key) == 1;
+  X509_free(x);
+  EVP_PKEY_free(key);
+  if (!ok) {
+    altcp_tls_free_config(conf);
+    return nullptr;
+  }
+  return conf;
+}
+
+void altcp_tls_free_config(struct altcp_tls_config *conf) {
+  SSL_CTX_free(conf->ctx);
+  delete conf;
+}
+
+struct altcp_tls_session *altcp_tls_alloc_session(void) {
+  return new altcp_tls_session{nullptr};
+}
+
+err_t altcp_tls_get_session(struct altcp_pcb *conn, struct altcp_tls_session *dest) {
+  if (conn == nullptr || conn->ssl == nullptr || !SSL_is_init_finished(conn->ssl)) return ERR_VAL;
+  SSL_SESSION *session = SSL_get1_session(conn->ssl);
+  if (session == nullptr) return ERR_VAL;
+  if (dest->session != nullptr) SSL_SESSION_free(dest->session);
+  dest->session = session;
+  return ERR_OK;
+}
+
+err_t altcp_tls_set_session(struct altcp_pcb *conn, struct altcp_tls_session *from) {
+  if (conn == nullptr || conn->ssl == nullptr || from->session == nullptr) return ERR_VAL;
+  return SSL_set_session(conn->ssl, from->session) == 1 ? ERR_OK : ERR_VAL;
+}
+
+void altcp_tls_free_session(struct altcp_tls_session *dest) {
+  if (dest->session != nullptr) SSL_SESSION_free(dest->session);
+  delete dest;
+}
+
+static void conn_free(struct altcp_pcb *conn) {
+  if (conn == nullptr) return;
+  if (conn->ssl != nullptr) SSL_free(conn->ssl);
+  close(conn->fd);
+  delete conn;
+}
+
+// conn_write writes what the connection takes: returns the byte count, 0 if it takes nothing now, -1 if it's gone
+static ssize_t conn_write(struct altcp_pcb *conn, const char *data, size_t len) {
+  if (conn->ssl == nullptr) {
+    for (;;) {
+      ssize_t n = send(conn->fd, data, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+      if (n >= 0) return n;
+      if (errno != EINTR) return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    }
+  }
+  int n = SSL_write(conn->ssl, data, (int)len);
+  if (n > 0) return n;
+  int err = SSL_get_error(conn->ssl, n);
+  return err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE ? 0 : -1;
+}
+
+// conn_read reads what arrived: returns the byte count, 0 if nothing did, -1 if the connection is closed or gone
+static ssize_t conn_read(struct altcp_pcb *conn, char *buf, size_t len) {
+  if (conn->ssl == nullptr) {
+    for (;;) {
+      ssize_t n = recv(conn->fd, buf, len, MSG_DONTWAIT);
+      if (n > 0) return n;
+      if (n == 0) return -1;
+      if (errno != EINTR) return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    }
+  }
+  int n = SSL_read(conn->ssl, buf, (int)len);
+  if (n > 0) return n;
+  int err = SSL_get_error(conn->ssl, n);
+  return err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE ? 0 : -1;
+}
+
+// MQTT 3.1.1 client, see lwip/apps/mqtt.h
+
+static const uint64_t CONNECT_TIMEOUT_US = 100 * 1000000ull; // lwIP's MQTT_CONNECT_TIMEOUT
+static const uint64_t REQ_TIMEOUT_US = 30 * 1000000ull; // lwIP's MQTT_REQ_TIMEOUT
+
+enum PACKET : uint8_t {
+    CONNECT = 1,
+    CONNACK,
+    PUBLISH,
+    PUBACK,
+    PUBREC,
+    PUBREL,
+    PUBCOMP,
+    SUBSCRIBE,
+    SUBACK,
+    UNSUBSCRIBE,
+    UNSUBACK,
+    PINGREQ,
+    PINGRESP,
+    DISCONNECT,
+};
+
+static std::vector<mqtt_client_t *> clients;
+
+static void put16(std::string &s, uint16_t v) {
+  s += (char)(v >> 8);
+  s += (char)(v & 0xFF);
+}
+
+static void put_str(std::string &s, const char *str) {
+  size_t n = strlen(str);
+  put16(s, n);
+  s.append(str, n);
+}
+
+static uint16_t get16(const std::string &s, size_t at) {
+  return (uint16_t)((uint8_t)s[at] << 8 | (uint8_t)s[at + 1]);
+}
+
+static std::string packet(uint8_t header, const std::string &body) {
+  std::string p(1, (char)header);
+  size_t len = body.size();
+  do {
+    uint8_t b = len % 128;
+    len /= 128;
+    if (len) b |= 128;
+    p += (char)b;
+  } while (len);
+  return p + body;
+}
+
+static bool has_space(mqtt_client_t *c, size_t len) {
+  return c->out.size() + len <= MQTT_OUTPUT_RINGBUF_SIZE;
+}
+
+static void queue(mqtt_client_t *c, const std::string &p) {
+  c->out += p;
+  c->queued += p.size();
+}
+
+static void queue_ack(mqtt_client_t *c, uint8_t header, uint16_t id) {
+  std::string body;
+  put16(body, id);
+  queue(c, packet(header, body));
+}
+
+static uint16_t new_id(mqtt_client_t *c) {
+  uint16_t id = c->next_id++;
+  if (c->next_id == 0) c->next_id = 1;
+  return id;
+}
+
+// close_client drops the connection and its requests, telling the connection callback unless reason is 0
+static void close_client(mqtt_client_t *c, mqtt_connection_status_t reason) {
+  conn_free(c->conn);
+  c->conn = nullptr;
+  c->failed = false;
+  c->out.clear();
+  c->in.clear();
+  c->requests.clear();
+  bool was_open = c->state != mqtt_client_s::DISCONNECTED;
+  c->state = mqtt_client_s::DISCONNECTED;
+  if (was_open && reason != 0 && c->connect_cb) c->connect_cb(c, c->connect_arg, reason);
+}
+
+static void complete(mqtt_client_t *c, uint16_t id, err_t err) {
+  for (auto r = c->requests.begin(); r != c->requests.end(); r++) {
+    if (r->id != id) continue;
+    mqtt_request_t done = *r;
+    c->requests.erase(r);
+    if (done.cb) done.cb(done.arg, err);
+    return;
+  }
+}
+
+mqtt_client_t *mqtt_client_new(void) {
+  auto c = new mqtt_client_t();
+  clients.push_back(c);
+  return c;
+}
+
+void mqtt_client_free(mqtt_client_t *client) {
+  conn_free(client->conn);
+  for (auto i = clients.begin(); i != clients.end(); i++) {
+    if (*i == client) {
+      clients.erase(i);
+      break;
+    }
+  }
+  delete client;
+}
+
+err_t mqtt_client_connect(mqtt_client_t *client, const ip_addr_t *ipaddr, u16_t port, mqtt_connection_cb_t cb,
+                          void *arg, const struct mqtt_connect_client_info_t *client_info) {
+  auto c = client;
+  if (c->state != mqtt_client_s::DISCONNECTED) return ERR_ISCONN;
+
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) return ERR_MEM;
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  SSL *ssl = nullptr;
+  if (client_info->tls_config != nullptr) {
+    ssl = SSL_new(client_info->tls_config->ctx);
+    if (ssl == nullptr) {
+      close(fd);
+      return ERR_MEM;
+    }
+    SSL_set_fd(ssl, fd);
+    SSL_set_mode(ssl, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    signal(SIGPIPE, SIG_IGN); // OpenSSL writes to the socket with write()
+  }
+  c->conn = new altcp_pcb{fd, ssl};
+
+  c->state = mqtt_client_s::TCP_CONNECTING;
+  c->connect_cb = cb;
+  c->connect_arg = arg;
+  c->keep_alive = client_info->keep_alive;
+  c->connect_us = c->last_rx_us = c->last_tx_us = time_us_64();
+
+  sockaddr_in sa = {};
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons(port);
+  sa.sin_addr.s_addr = ipaddr->addr;
+  if (connect(fd, (sockaddr *)&sa, sizeof(sa)) != 0 && errno != EINPROGRESS) c->failed = true;
+
+  // written once TCP is up
+  uint8_t flags = 0x02; // clean session, as lwIP
+  std::string body;
+  put_str(body, "MQTT");
+  body += (char)4; // 3.1.1
+  size_t flags_at = body.size();
+  body += (char)0;
+  put16(body, c->keep_alive);
+  put_str(body, client_info->client_id);
+  if (client_info->will_topic != nullptr) {
+    flags |= 0x04 | (client_info->will_qos & 3) << 3 | (client_info->will_retain ? 0x20 : 0);
+    put_str(body, client_info->will_topic);
+    put_str(body, client_info->will_msg != nullptr ? client_info->will_msg : "");
+  }
+  if (client_info->client_user != nullptr) {
+    flags |= 0x80;
+    put_str(body, client_info->client_user);
+  }
+  if (client_info->client_pass != nullptr) {
+    flags |= 0x40;
+    put_str(body, client_info->client_pass);
+  }
+  body[flags_at] = (char)flags;
+  queue(c, packet(CONNECT << 4, body));
+  return ERR_OK;
+}
+
+void mqtt_disconnect(mqtt_client_t *client) {
+  close_client(client, (mqtt_connection_status_t)0);
+}
+
+u8_t mqtt_client_is_connected(mqtt_client_t *client) {
+  return client->state == mqtt_client_s::CONNECTED;
+}
+
+void mqtt_set_inpub_callback(mqtt_client_t *client, mqtt_incoming_publish_cb_t pub_cb,
+                             mqtt_incoming_data_cb_t data_cb, void *arg) {
+  client->pub_cb = pub_cb;
+  client->data_cb = data_cb;
+  client->inpub_arg = arg;
+}
+
+// request queues a packet that completes with a request callback
+static err_t request(mqtt_client_t *c, uint8_t header, uint16_t id, const std::string &body, mqtt_request_cb_t cb,
+                     void *arg) {
+  if (c->state != mqtt_client_s::CONNECTED) return ERR_CONN;
+  std::string p = packet(header, body);
+  if (c->requests.size() >= MQTT_REQ_MAX_IN_FLIGHT || !has_space(c, p.size())) return ERR_MEM;
+  queue(c, p);
+  c->requests.push_back({id, c->queued, time_us_64(), cb, arg});
+  return ERR_OK;
+}
+
+err_t mqtt_subscribe(mqtt_client_t *client, const char *topic, u8_t qos, mqtt_request_cb_t cb, void *arg) {
+  if (qos > 2) return ERR_ARG;
+  uint16_t id = new_id(client);
+  std::string body;
+  put16(body, id);
+  put_str(body, topic);
+  body += (char)qos;
+  return request(client, SUBSCRIBE << 4 | 0x02, id, body, cb, arg);
+}
+
+err_t mqtt_unsubscribe(mqtt_client_t *client, const char *topic, mqtt_request_cb_t cb, void *arg) {
+  uint16_t id = new_id(client);
+  std::string body;
+  put16(body, id);
+  put_str(body, topic);
+  return request(client, UNSUBSCRIBE << 4 | 0x02, id, body, cb, arg);
+}
+
+err_t mqtt_publish(mqtt_client_t *client, const char *topic, const void *payload, u16_t payload_length, u8_t qos,
+                   u8_t retain, mqtt_request_cb_t cb, void *arg) {
+  if (qos > 2) return ERR_ARG;
+  uint16_t id = qos > 0 ? new_id(client) : 0;
+  std::string body;
+  put_str(body, topic);
+  if (qos > 0) put16(body, id);
+  body.append((const char *)payload, payload_length);
+  return request(client, PUBLISH << 4 | qos << 1 | (retain ? 1 : 0), id, body, cb, arg);
+}
+
+// flush writes what the socket takes. returns false if the connection is gone.
+static bool flush(mqtt_client_t *c) {
+  while (!c->out.empty()) {
+    ssize_t n = conn_write(c->conn, c->out.data(), c->out.size());
+    if (n <= 0) return n == 0;
+    c->out.erase(0, n);
+    c->written += n;
+    c->last_tx_us = time_us_64();
+  }
+
+  // QoS 0 publishes are done once they're out
+  for (size_t i = 0; i < c->requests.size();) {
+    auto r = c->requests[i];
+    if (r.id != 0 || r.done_at > c->written) {
+      i++;
+      continue;
+    }
+    c->requests.erase(c->requests.begin() + i);
+    if (r.cb) r.cb(r.arg, ERR_OK);
+    if (c->state == mqtt_client_s::DISCONNECTED) return true;
+  }
+  return true;
+}
+
+// incoming_publish hands a PUBLISH to the callbacks, in pieces like lwIP does
+static void incoming_publish(mqtt_client_t *c, uint8_t header, const std::string &body) {
+  uint8_t qos = (header >> 1) & 3;
+  size_t at = 2 + (body.size() >= 2 ? get16(body, 0) : 0);
+  if (body.size() < at + (qos > 0 ? 2 : 0)) {
+    close_client(c, MQTT_CONNECT_DISCONNECTED); // malformed
+    return;
+  }
+  std::string topic = body.substr(2, at - 2);
+  if (qos > 0) {
+    queue_ack(c, (qos == 1 ? PUBACK : PUBREC) << 4, get16(body, at));
+    at += 2;
+  }
+
+  size_t len = body.size() - at;
+  if (c->pub_cb) c->pub_cb(c->inpub_arg, topic.c_str(), len);
+  if (!c->data_cb) return;
+  if (len == 0) c->data_cb(c->inpub_arg, nullptr, 0, MQTT_DATA_FLAG_LAST);
+  while (at < body.size() && c->state != mqtt_client_s::DISCONNECTED) {
+    size_t n = std::min<size_t>(body.size() - at, MQTT_VAR_HEADER_BUFFER_LEN);
+    c->data_cb(c->inpub_arg, (const u8_t *)body.data() + at, n, at + n == body.size() ? MQTT_DATA_FLAG_LAST : 0);
+    at += n;
+  }
+}
+
+static void incoming(mqtt_client_t *c, uint8_t header, const std::string &body) {
+  uint16_t id = body.size() >= 2 ? get16(body, 0) : 0;
+  switch (header >> 4) {
+    case CONNACK: {
+      if (c->state != mqtt_client_s::MQTT_CONNECTING || body.size() < 2) return;
+      auto status = (mqtt_connection_status_t)(uint8_t)body[1];
+      if (status == MQTT_CONNECT_ACCEPTED) c->state = mqtt_client_s::CONNECTED;
+      if (c->connect_cb) c->connect_cb(c, c->connect_arg, status);
+      break;
+    }
+    case PUBLISH: incoming_publish(c, header, body); break;
+    case PUBACK: complete(c, id, ERR_OK); break;
+    case PUBREC: queue_ack(c, PUBREL << 4 | 0x02, id); break;
+    case PUBREL: queue_ack(c, PUBCOMP << 4, id); break;
+    case PUBCOMP: complete(c, id, ERR_OK); break;
+    case SUBACK: complete(c, id, body.size() > 2 && (uint8_t)body[2] == 0x80 ? ERR_ABRT : ERR_OK); break;
+    case UNSUBACK: complete(c, id, ERR_OK); break;
+    default: break; // PINGRESP: receiving anything is enough
+  }
+}
+
+// poll_client does the client's socket I/O, and runs its callbacks
+static void poll_client(mqtt_client_t *c) {
+  uint64_t now = time_us_64();
+  if (c->state == mqtt_client_s::DISCONNECTED) return;
+  if (c->failed) return close_client(c, MQTT_CONNECT_DISCONNECTED);
+
+  if (c->state == mqtt_client_s::TCP_CONNECTING) {
+    pollfd p = {c->conn->fd, POLLOUT, 0};
+    if (poll(&p, 1, 0) <= 0) {
+      if (now - c->connect_us > CONNECT_TIMEOUT_US) close_client(c, MQTT_CONNECT_TIMEOUT);
+      return;
+    }
+    int err = 0;
+    socklen_t len = sizeof(err);
+    getsockopt(c->conn->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    if (err != 0) return close_client(c, MQTT_CONNECT_DISCONNECTED);
+    c->state = c->conn->ssl != nullptr ? mqtt_client_s::TLS_HANDSHAKE : mqtt_client_s::MQTT_CONNECTING;
+  }
+
+  if (c->state == mqtt_client_s::TLS_HANDSHAKE) {
+    int n = SSL_connect(c->conn->ssl);
+    if (n != 1) {
+      int err = SSL_get_error(c->conn->ssl, n);
+      if (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE) {
+        printf("[tls] handshake failed: %s\n", ERR_reason_error_string(ERR_get_error()));
+        return close_client(c, MQTT_CONNECT_DISCONNECTED);
+      }
+      if (now - c->connect_us > CONNECT_TIMEOUT_US) close_client(c, MQTT_CONNECT_TIMEOUT);
+      return;
+    }
+    c->state = mqtt_client_s::MQTT_CONNECTING; // the CONNECT queued by mqtt_client_connect goes out now
+  }
+
+  if (!flush(c)) return close_client(c, MQTT_CONNECT_DISCONNECTED);
+
+  char buf[4096];
+  while (c->state != mqtt_client_s::DISCONNECTED) {
+    ssize_t n = conn_read(c->conn, buf, sizeof(buf));
+    if (n < 0) return close_client(c, MQTT_CONNECT_DISCONNECTED);
+    if (n == 0) break;
+    c->in.append(buf, n);
+    c->last_rx_us = now;
+  }
+
+  // complete packets: the fixed header, its remaining length (1 to 4 bytes, 7 bits each), the rest
+  while (c->state != mqtt_client_s::DISCONNECTED && c->in.size() >= 2) {
+    size_t len = 0, at = 1;
+    for (; at < c->in.size() && at <= 4; at++) {
+      len |= (size_t)((uint8_t)c->in[at] & 127) << (7 * (at - 1));
+      if (!((uint8_t)c->in[at] & 128)) break;
+    }
+    if (at > 4) return close_client(c, MQTT_CONNECT_DISCONNECTED); // malformed
+    if (at >= c->in.size() || c->in.size() < at + 1 + len) break; // not all in yet
+    uint8_t header = c->in[0];
+    std::string body = c->in.substr(at + 1, len);
+    c->in.erase(0, at + 1 + len);
+    incoming(c, header, body);
+  }
+  if (c->state == mqtt_client_s::DISCONNECTED) return;
+
+  if (c->state == mqtt_client_s::MQTT_CONNECTING && now - c->connect_us > CONNECT_TIMEOUT_US) {
+    return close_client(c, MQTT_CONNECT_TIMEOUT);
+  }
+  if (c->state == mqtt_client_s::CONNECTED && c->keep_alive > 0) {
+    uint64_t keep_alive_us = c->keep_alive * 1000000ull;
+    if (now - c->last_rx_us > keep_alive_us * 3 / 2) return close_client(c, MQTT_CONNECT_TIMEOUT);
+    if (now - c->last_tx_us >= keep_alive_us && has_space(c, 2)) queue(c, packet(PINGREQ << 4, ""));
+  }
+  for (size_t i = 0; i < c->requests.size();) {
+    auto r = c->requests[i];
+    if (now - r.time_us <= REQ_TIMEOUT_US) {
+      i++;
+      continue;
+    }
+    c->requests.erase(c->requests.begin() + i);
+    if (r.cb) r.cb(r.arg, ERR_TIMEOUT);
+    if (c->state == mqtt_client_s::DISCONNECTED) return;
+  }
+
+  if (!flush(c)) close_client(c, MQTT_CONNECT_DISCONNECTED); // acks and pings
+}
+
+// cyw43_arch_poll runs the stack: failed lookups are reported, and every client does its I/O. Callbacks mustn't free
+// their own client.
+void cyw43_arch_poll() {
+  std::vector<lookup_t> lookups;
+  lookups.swap(failed_lookups);
+  for (auto &l : lookups) l.found(l.name.c_str(), nullptr, l.arg);
+
+  for (size_t i = 0; i < clients.size(); i++) poll_client(clients[i]);
+}
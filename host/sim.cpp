@@ -0,0 +1,201 @@
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "pico/stdlib.h"
+#include "ledcontrol.h"
+#include "encoder.h"
+#include "frameclock.h"
+#include "profile.h"
+#include "logging.h"
+#include "config.h"
+#include "sim.h"
+
+// Host simulator: runs LEDControl's main loop (as main() does without WiFi) on the fake HAL, driven by a script.
+//
+// usage: ledcontrol_sim [-f flash.bin] [script]
+//
+// The script is read from stdin if not given. One command per line, # starts a comment:
+//   wait <ms>            run the main loop for this long
+//   turn <detents>       turn the encoder, negative is counter-clockwise
+//   click                click the encoder button
+//   press <b|c> [ms]     press button B or C, for 100ms or the given time
+//   absent <0|1>         set presence, as the presence sensor would
+//   brightness <pct>     queue a brightness change, as an MQTT command would
+//   state                print the LEDControl state
+//   frame [leds]         print the last captured frame: time, hash and the first few (or given number of) pixels
+//   stats                print output, frame clock, command and stage timing stats
+//   dump <path>          write every captured frame: per frame, u64 time_us, u32 num_leds, then the pixel words
+//
+// With -f, flash is loaded from the file at start (if it exists) and written back at exit.
+
+static uint32_t frame_hash(const sim::frame_t &f) {
+  uint32_t hash = 2166136261u;
+  for (auto px : f.pixels) hash = (hash ^ px) * 16777619u;
+  return hash;
+}
+
+static void run_for(LEDControl *leds, uint32_t ms) {
+  uint64_t end = time_us_64() + (uint64_t)ms * 1000;
+  while (time_us_64() < end) {
+    leds->loop();
+    logging::drain(LOG_DRAIN_BUDGET_US);
+    frame_clock.wait();
+  }
+  logging::drain();
+}
+
+// turn schedules the quadrature edges for the given number of detents, 2ms apart
+static void turn(int detents) {
+  // A, B levels for one detent, starting from (and ending at) both high
+  static const bool cw[4][2] = {{0, 1}, {0, 0}, {1, 0}, {1, 1}};
+  static const bool ccw[4][2] = {{1, 0}, {0, 0}, {0, 1}, {1, 1}};
+  auto steps = detents > 0 ? cw : ccw;
+
+  uint64_t t = time_us_64() + 1000;
+  for (int i = 0; i < abs(detents); i++) {
+    for (int s = 0; s < 4; s++, t += 2000) {
+      if (steps[s][0] != (s == 0 ? true : steps[s - 1][0])) sim::schedule_gpio(t, ROT_A, steps[s][0]);
+      if (steps[s][1] != (s == 0 ? true : steps[s - 1][1])) sim::schedule_gpio(t, ROT_B, steps[s][1]);
+    }
+  }
+}
+
+static void press(uint pin, bool active_low, uint32_t ms) {
+  uint64_t t = time_us_64();
+  sim::schedule_gpio(t, pin, !active_low);
+  sim::schedule_gpio(t + (uint64_t)ms * 1000, pin, active_low);
+}
+
+static void print_frame(size_t leds) {
+  if (sim::frames().empty()) {
+    printf("[sim] frame: none\n");
+    return;
+  }
+  auto &f = sim::frames().back();
+  printf("[sim] frame %zu at %llu us, hash %08x:", sim::frames().size(), (unsigned long long)f.time_us, frame_hash(f));
+  for (size_t i = 0; i < leds && i < f.pixels.size(); i++) printf(" %08x", f.pixels[i]);
+  printf("\n");
+}
+
+static void print_clock_stats(const char *name, FrameClock::stats_t s) {
+  printf("[sim] %s clock: frames: %u, missed: %u, early: %u, period: %u-%u us, late: avg %llu max %u us\n", name,
+         s.frames, s.missed, s.early, s.period_min_us, s.period_max_us,
+         (unsigned long long)(s.frames ? s.late_total_us / s.frames : 0), s.late_max_us);
+}
+
+static int dump_frames(const char *path) {
+  FILE *f = fopen(path, "wb");
+  if (f == nullptr) return -1;
+  for (auto &fr : sim::frames()) {
+    uint32_t n = fr.pixels.size();
+    fwrite(&fr.time_us, sizeof(fr.time_us), 1, f);
+    fwrite(&n, sizeof(n), 1, f);
+    fwrite(fr.pixels.data(), sizeof(uint32_t), n, f);
+  }
+  fclose(f);
+  return 0;
+}
+
+static int run_command(LEDControl *leds, char *line) {
+  char *hash = strchr(line, '#');
+  if (hash) *hash = '\0';
+
+  char cmd[32], arg[256] = "";
+  int n = sscanf(line, "%31s %255s", cmd, arg);
+  if (n < 1) return 0;
+
+  if (strcmp(cmd, "wait") == 0) {
+    run_for(leds, strtoul(arg, nullptr, 10));
+  } else if (strcmp(cmd, "turn") == 0) {
+    turn(atoi(arg));
+  } else if (strcmp(cmd, "click") == 0) {
+    press(ROT_SW, false, 100);
+  } else if (strcmp(cmd, "press") == 0) {
+    uint32_t ms = 100;
+    sscanf(line, "%*s %*s %u", &ms);
+    if (strcmp(arg, "b") == 0) {
+      press(BUTTON_B_PIN, true, ms);
+    } else if (strcmp(arg, "c") == 0) {
+      press(BUTTON_C_PIN, true, ms);
+    } else {
+      return -1;
+    }
+  } else if (strcmp(cmd, "absent") == 0) {
+    auto s = leds->get_state();
+    s.absent = atoi(arg) != 0;
+    leds->enable_state(s);
+  } else if (strcmp(cmd, "brightness") == 0) {
+    // like a brightness slider command from MQTT: queued for the next frame
+    auto s = leds->get_pending_state();
+    s.brightness = atoi(arg) / 100.0f;
+    leds->queue_state(s);
+  } else if (strcmp(cmd, "state") == 0) {
+    leds->log_state("sim", leds->get_state());
+  } else if (strcmp(cmd, "frame") == 0) {
+    print_frame(n > 1 ? strtoul(arg, nullptr, 10) : 4);
+  } else if (strcmp(cmd, "stats") == 0) {
+    auto s = leds->get_output_stats();
+    printf("[sim] frames sent: %u, skipped: %u, bus time saved: %llu us\n", s.frames_sent, s.frames_skipped, (unsigned long long)s.bus_us_saved);
+    print_clock_stats("main loop", frame_clock.get_stats());
+    print_clock_stats("renderer", leds->get_clock_stats());
+    auto g = leds->get_governor_stats();
+    printf("[sim] governor: rate: %u fps (max %u), render: %u us, changes: %u, missed: %u\n",
+           g.rate, g.max_rate, g.render_us, g.changes, g.missed);
+    auto cs = leds->get_command_stats();
+    printf("[sim] commands queued: %u, applied: %u, coalesced: %u\n", cs.queued, cs.applied, cs.coalesced);
+    profile::print();
+  } else if (strcmp(cmd, "dump") == 0) {
+    if (dump_frames(arg) != 0) return -1;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  const char *flash_path = nullptr;
+  const char *script_path = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+      flash_path = argv[++i];
+    } else {
+      script_path = argv[i];
+    }
+  }
+
+  if (flash_path && sim::load_flash(flash_path) != 0) printf("[sim] no flash image at %s, starting erased\n", flash_path);
+
+  FILE *script = script_path ? fopen(script_path, "r") : stdin;
+  if (script == nullptr) {
+    fprintf(stderr, "can't open %s\n", script_path);
+    return 1;
+  }
+
+  logging::init();
+  auto *leds = new LEDControl();
+  leds->init(&encoder);
+  frame_clock.init(1000000 / UPDATES);
+
+  int ret = 0;
+  char line[512];
+  for (int lineno = 1; fgets(line, sizeof(line), script); lineno++) {
+    int err = run_command(leds, line);
+    logging::drain(); // state goes through the log ring: print it before the next command's output
+    if (err != 0) {
+      fprintf(stderr, "line %d: invalid command: %s", lineno, line);
+      ret = 1;
+      break;
+    }
+  }
+
+  if (flash_path && sim::save_flash(flash_path) != 0) {
+    fprintf(stderr, "can't write %s\n", flash_path);
+    ret = 1;
+  }
+
+  fflush(stdout);
+  // core1 never returns, don't wait for it
+  _Exit(ret);
+}
@@ -0,0 +1,45 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include "pico/types.h"
+
+// Simulator side of the fake HAL: things the script drives or inspects, that the firmware can't see.
+namespace sim {
+
+    // captured frame: what LEDStrip::present() would have sent, as pixel words
+    typedef struct {
+        uint64_t time_us;
+        std::vector<uint32_t> pixels;
+    } frame_t;
+
+    // schedule_gpio sets an input pin to the given level at the given (virtual) time. Edge IRQs fire on core0.
+    void schedule_gpio(uint64_t time_us, uint pin, bool level);
+    bool gpio_level(uint pin);
+
+    // capture_frame is called by the host LEDStrip for every frame presented
+    void capture_frame(const uint32_t *pixels, uint32_t num_leds);
+    const std::vector<frame_t> &frames();
+
+    // load_flash/save_flash read and write the whole flash image. Without a load, flash starts erased.
+    int load_flash(const char *path);
+    int save_flash(const char *path);
+
+    // The network (net.cpp, only in test_iot): one access point, 02:00:00:00:00:01 on channel 6 unless set otherwise.
+    // Scans find it, joins straight to another BSSID or channel never finish.
+    typedef struct {
+        uint64_t time_us;
+        bool fast; // straight to bssid on channel, without a scan
+        uint8_t bssid[6];
+        uint32_t channel;
+    } wifi_join_t;
+
+    void set_access_point(const uint8_t bssid[6], uint32_t channel);
+    const std::vector<wifi_join_t> &joins();
+    // dns_lookups counts the names looked up, addresses don't need a lookup
+    uint32_t dns_lookups();
+}
+
+#endif //SIM_H
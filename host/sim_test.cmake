@@ -0,0 +1,15 @@
+# Runs a sim script from erased flash, and compares its frames and states with the expected ones.
+# cmake -DSIM=<ledcontrol_sim> -DSCRIPT=<script.sim> -DEXPECTED=<file> -DFLASH=<scratch flash.bin> -P sim_test.cmake
+file(REMOVE ${FLASH})
+execute_process(COMMAND ${SIM} -f ${FLASH} ${SCRIPT} OUTPUT_VARIABLE out RESULT_VARIABLE result)
+if (NOT result EQUAL 0)
+    message(FATAL_ERROR "${SIM} exited with ${result}:\n${out}")
+endif()
+
+# only the [sim] frame and state lines: logging and stats may change without the behaviour changing
+string(REGEX MATCHALL "\\[sim\\] (frame [0-9]|hue:)[^\n]*\n" lines "${out}")
+string(REPLACE ";" "" actual "${lines}")
+file(READ ${EXPECTED} expected)
+if (NOT actual STREQUAL expected)
+    message(FATAL_ERROR "output differs from ${EXPECTED}\nexpected:\n${expected}\nactual:\n${actual}")
+endif()
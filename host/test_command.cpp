@@ -0,0 +1,266 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "command.h"
+#include "cJSON.h"
+
+// command::parse against cJSON, which on_command used before it: random Home Assistant style commands, and random
+// mutations of them (flipped, inserted and deleted bytes, truncation), must give the same accept/reject and the same
+// fields as cJSON_ParseWithLength and cJSON_GetObjectItem.
+//
+// usage: test_command [iterations] [seed]
+
+using namespace ledcontrol;
+
+static uint32_t rng;
+
+static uint32_t next_random() {
+  rng ^= rng << 13; rng ^= rng >> 17; rng ^= rng << 5; // xorshift32
+  return rng;
+}
+
+static uint32_t below(uint32_t n) {
+  return next_random() % n;
+}
+
+template <typename T, size_t N>
+static const T &pick(const T (&a)[N]) {
+  return a[below(N)];
+}
+
+// Home Assistant commands, as its JSON schema light sends them, and a few we don't act on
+static const char *COMMANDS[] = {
+    R"({"state":"ON"})",
+    R"({"state":"OFF"})",
+    R"({"state":"OFF","transition":2})",
+    R"({"state":"ON","brightness":255})",
+    R"({"state":"ON","brightness":3,"transition":0.5})",
+    R"({"state":"ON","color":{"h":24.0,"s":100.0}})",
+    R"({"state":"ON","color_mode":"hs","color":{"h":300.235,"s":64.706,"r":255,"g":90,"b":241}})",
+    R"({"state":"ON","effect":"Hue:Slow"})",
+    R"({"state": "ON", "effect": "White chase:Fast", "transition": 10})",
+    R"({"brightness": 52, "color_mode":"hs", "color": {"h": 180, "s": 50}, "effect":"Hue:Stopped", "state":"ON"})",
+    R"({"state":"ON","color":{"x":0.3,"y":0.4},"white":255})",
+    R"({"state":"ON","flash":"short"})",
+};
+
+static const char *KEYS[] = {"state", "effect", "color", "brightness", "transition", "h", "s", "color_mode", "r"};
+
+static const char *STRINGS[] = {
+    "ON", "OFF", "on", "Hue:Slow", "White chase:Fast", "",
+    "a string that is longer than any of the buffers in command_t, by quite a bit",
+    R"(\"quoted\")", R"(tab\there)", R"(\/\\\b\f\n\r)", R"(café)", R"(€)",
+    R"(😀)", R"(ON\u0000OFF)", R"(\ud83d)", R"(\ude00)", R"(\uZZZZ)", R"(\x)", "caf\xc3\xa9",
+};
+
+static const char *NUMBERS[] = {
+    "0", "-0", "1", "255", "-17", "0.5", "24.0", "300.235", "1e2", "1E-3", "2.5e+1", "012", "1.", "-.5",
+    "123456789012345678", "0.000000000000000000001", "1e400", "-1e-400", "1e", "1e+", "--1", "-", "1-2", "1.2.3",
+};
+
+static const char *WHITESPACE[] = {"", "", "", " ", "\n", "\t", "\r\n  "};
+
+static void whitespace(std::string &out) {
+  out += pick(WHITESPACE);
+}
+
+static void key(std::string &out) {
+  std::string k = below(8) ? pick(KEYS) : pick(STRINGS);
+  for (auto &c : k) {
+    if (below(6) == 0 && c >= 'a' && c <= 'z') c -= 32; // keys match case-insensitively
+  }
+  out += '"' + k + '"';
+}
+
+static void value(std::string &out, uint32_t depth, const char *k);
+
+static void object(std::string &out, uint32_t depth, bool color) {
+  out += '{';
+  whitespace(out);
+  uint32_t n = below(6);
+  for (uint32_t i = 0; i < n; i++) {
+    if (i > 0) out += ',';
+    whitespace(out);
+    const char *k = color ? (below(2) ? "h" : "s") : pick(KEYS);
+    if (below(4) == 0) {
+      key(out);
+      k = nullptr;
+    } else {
+      out += '"' + std::string(k) + '"';
+    }
+    whitespace(out);
+    out += ':';
+    whitespace(out);
+    value(out, depth + 1, k);
+    whitespace(out);
+  }
+  out += '}';
+}
+
+// value writes a random value, mostly of the type the key is expected to have
+static void value(std::string &out, uint32_t depth, const char *k) {
+  uint32_t type = below(8);
+  if (k != nullptr && below(4) != 0) {
+    if (strcmp(k, "state") == 0 || strcmp(k, "effect") == 0 || strcmp(k, "color_mode") == 0) type = 0;
+    else if (strcmp(k, "color") == 0) type = 5;
+    else type = 1;
+  }
+  if (depth >= 4 && type >= 5) type = below(5);
+
+  switch (type) {
+    case 0: out += '"' + std::string(pick(STRINGS)) + '"'; break;
+    case 1: out += pick(NUMBERS); break;
+    case 2: out += "true"; break;
+    case 3: out += "false"; break;
+    case 4: out += "null"; break;
+    case 5: case 6: object(out, depth, k != nullptr && strcmp(k, "color") == 0); break;
+    default: {
+      out += '[';
+      uint32_t n = below(4);
+      for (uint32_t i = 0; i < n; i++) {
+        if (i > 0) out += ',';
+        whitespace(out);
+        value(out, depth + 1, nullptr);
+      }
+      out += ']';
+    }
+  }
+}
+
+static std::string generate() {
+  if (below(2)) return pick(COMMANDS);
+  std::string out;
+  if (below(20) == 0) out += "\xEF\xBB\xBF";
+  whitespace(out);
+  if (below(10) == 0) value(out, 0, nullptr);
+  else object(out, 0, false);
+  whitespace(out);
+  if (below(10) == 0) out += pick(STRINGS); // trailing data
+  return out;
+}
+
+static void mutate(std::string &s) {
+  static const char ALPHABET[] = "{}[]\":,\\-+.eE019 tfnu\x00\xff";
+  uint32_t n = 1 + below(3);
+  for (uint32_t i = 0; i < n && !s.empty(); i++) {
+    size_t at = below(s.size());
+    switch (below(5)) {
+      case 0: s[at] = ALPHABET[below(sizeof(ALPHABET) - 1)]; break;
+      case 1: s.insert(s.begin() + at, ALPHABET[below(sizeof(ALPHABET) - 1)]); break;
+      case 2: s.erase(at, 1); break;
+      case 3: s.resize(at); break;
+      default: s.insert(at, s.substr(at, below(8))); break;
+    }
+  }
+}
+
+// reference is what on_command read with cJSON, as a command_t
+static int reference(const std::vector<char> &data, command::command_t *cmd) {
+  memset(cmd, 0, sizeof(*cmd));
+  cJSON *json = cJSON_ParseWithLength(data.data(), data.size());
+  if (json == nullptr) return -1;
+
+  auto string = [&](const char *name, char *out, size_t cap, uint8_t field) {
+    cJSON *item = cJSON_GetObjectItem(json, name);
+    if (!cJSON_IsString(item) || item->valuestring == nullptr) return;
+    strncpy(out, item->valuestring, cap - 1);
+    cmd->fields |= field;
+  };
+  auto number = [&](cJSON *obj, const char *name, double *out) {
+    cJSON *item = cJSON_GetObjectItem(obj, name);
+    if (!cJSON_IsNumber(item)) return false;
+    *out = item->valuedouble;
+    return true;
+  };
+
+  string("state", cmd->state, sizeof(cmd->state), command::STATE);
+  string("effect", cmd->effect, sizeof(cmd->effect), command::EFFECT);
+  cJSON *color = cJSON_GetObjectItem(json, "color");
+  if (cJSON_IsObject(color)) {
+    cmd->fields |= command::COLOR_OBJECT;
+    double h, s;
+    if (number(color, "h", &h) && number(color, "s", &s)) {
+      cmd->fields |= command::COLOR;
+      cmd->h = h;
+      cmd->s = s;
+    }
+  }
+  if (number(json, "brightness", &cmd->brightness)) cmd->fields |= command::BRIGHTNESS;
+  if (number(json, "transition", &cmd->transition)) cmd->fields |= command::TRANSITION;
+
+  cJSON_Delete(json);
+  return 0;
+}
+
+// same_number allows the last bit or so: command::parse is only exact up to 15 significant digits (see number())
+static bool same_number(double a, double b) {
+  if (a == b || (std::isnan(a) && std::isnan(b))) return true;
+  return std::fabs(a - b) <= std::fabs(b) * 1e-15;
+}
+
+static std::string printable(const std::vector<char> &data) {
+  std::string out;
+  for (char c : data) {
+    if (out.size() >= 200) return out + "...";
+    if (c >= 32 && c < 127 && c != '\\') {
+      out += c;
+    } else {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\x%02x", (uint8_t)c);
+      out += buf;
+    }
+  }
+  return out;
+}
+
+static bool check(const std::vector<char> &data) {
+  command::command_t got, want;
+  int res = command::parse(data.data(), data.size(), &got);
+  int want_res = reference(data, &want);
+
+  std::string diff;
+  if (res != want_res) diff += " result " + std::to_string(res) + " vs " + std::to_string(want_res);
+  if (got.fields != want.fields) diff += " fields " + std::to_string(got.fields) + " vs " + std::to_string(want.fields);
+  uint8_t both = got.fields & want.fields;
+  if ((both & command::STATE) && strcmp(got.state, want.state) != 0) diff += " state";
+  if ((both & command::EFFECT) && strcmp(got.effect, want.effect) != 0) diff += " effect";
+  if ((both & command::COLOR) && (!same_number(got.h, want.h) || !same_number(got.s, want.s))) diff += " color";
+  if ((both & command::BRIGHTNESS) && !same_number(got.brightness, want.brightness)) diff += " brightness";
+  if ((both & command::TRANSITION) && !same_number(got.transition, want.transition)) diff += " transition";
+
+  if (diff.empty()) return true;
+  printf("differs from cJSON (%s ): %s\n", diff.c_str() + 1, printable(data).c_str());
+  return false;
+}
+
+static std::vector<char> nested(uint32_t depth) {
+  std::string s = "{\"state\":\"ON\",\"x\":" + std::string(depth - 1, '[') + std::string(depth - 1, ']') + "}";
+  return std::vector<char>(s.begin(), s.end());
+}
+
+int main(int argc, char **argv) {
+  uint32_t iterations = argc > 1 ? strtoul(argv[1], nullptr, 10) : 200000;
+  rng = argc > 2 ? strtoul(argv[2], nullptr, 10) : 1;
+  if (rng == 0) rng = 1;
+
+  int failures = 0;
+  // around the nesting limit, which the generator doesn't get near
+  for (uint32_t depth : {999, 1000, 1001}) {
+    if (!check(nested(depth))) failures++;
+  }
+
+  for (uint32_t i = 0; i < iterations && failures < 20; i++) {
+    std::string s = generate();
+    if (below(2)) mutate(s);
+    // exactly len bytes, like an MQTT payload: nothing to find after the end
+    if (!check(std::vector<char>(s.begin(), s.end()))) failures++;
+  }
+
+  if (failures) return EXIT_FAILURE;
+  printf("ok\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,376 @@
+#include <arpa/inet.h>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "iot.h"
+#include "pico/unique_id.h"
+#include "sim.h"
+
+// IOT's connection state machine against a real broker: it connects, subscribes and publishes its state, and when the
+// broker is killed and started again it reconnects by itself, with what was published in the meantime. An observer
+// client, on the same (host) lwIP, watches the state topic and sends the commands.
+//
+// Before that, fresh boards (one per process) check the network settings cached in flash: a board with nothing cached,
+// or a cache that isn't for this network, scans and looks the broker up; one with a cache joins the access point
+// straight away and uses the cached broker address. If the access point moved, the fast join times out and the board
+// scans; if the broker's address is stale, it's looked up again.
+//
+// Built with MQTT_TLS (test_iot_tls), the broker listens with TLS, on the given certificate and key: the board must
+// offer its last session when it reconnects.
+//
+// usage: test_iot <mosquitto> <port> [<cert> <key>], where MQTT_SERVERS is {{"localhost", port}}
+
+static int failures = 0;
+
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+static const char *mosquitto;
+static uint16_t port;
+static const char *cert_file = nullptr, *key_file = nullptr;
+static pid_t broker = 0;
+
+#ifdef MQTT_TLS
+char test_broker_cert[4096];
+static altcp_tls_config *observer_tls = nullptr;
+
+static bool read_cert() {
+  FILE *f = fopen(cert_file, "r");
+  if (f == nullptr) return false;
+  size_t n = fread(test_broker_cert, 1, sizeof(test_broker_cert) - 1, f);
+  fclose(f);
+  test_broker_cert[n] = '\0';
+  return n > 0 && n < sizeof(test_broker_cert) - 1;
+}
+#endif
+
+static void stop_broker() {
+  if (broker == 0) return;
+  kill(broker, SIGKILL);
+  waitpid(broker, nullptr, 0);
+  broker = 0;
+}
+
+// start_broker starts mosquitto on 127.0.0.1 only (nothing answers on 127.0.0.2), with TLS if there's a certificate,
+// and waits (in real time) until it takes connections
+static bool start_broker() {
+  std::string conf = "/tmp/test_iot_" + std::to_string(port) + ".conf";
+  FILE *f = fopen(conf.c_str(), "w");
+  if (f == nullptr) return false;
+  fprintf(f, "listener %u 127.0.0.1\nallow_anonymous true\n", port);
+  if (cert_file != nullptr) fprintf(f, "certfile %s\nkeyfile %s\n", cert_file, key_file);
+  fclose(f);
+
+  broker = fork();
+  if (broker == 0) {
+    execl(mosquitto, mosquitto, "-c", conf.c_str(), (char *)nullptr);
+    _exit(127);
+  }
+  if (broker < 0) return false;
+
+  for (int i = 0; i < 500; i++) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in sa = {};
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bool up = connect(fd, (sockaddr *)&sa, sizeof(sa)) == 0;
+    close(fd);
+    if (up) return true;
+    if (waitpid(broker, nullptr, WNOHANG) == broker) break; // exited
+    usleep(10000);
+  }
+  printf("%s didn't start on port %u\n", mosquitto, port);
+  broker = 0;
+  return false;
+}
+
+// the board
+
+static int connects = 0;
+static std::string command;
+static int commands = 0;
+
+static void on_connect() {
+  if (connects++ == 0) iot.publish_state("{\"state\":\"one\"}");
+}
+
+static void on_command(const char *data, size_t len) {
+  command.assign(data, len);
+  commands++;
+}
+
+// the observer
+
+static std::string state_topic, command_topic;
+static mqtt_client_t *observer;
+static bool observer_up = false, observer_subscribed = false;
+static std::string state, rx;
+
+static void observer_connection_cb(mqtt_client_t *client, void *arg, mqtt_connection_status_t status) {
+  observer_up = status == MQTT_CONNECT_ACCEPTED;
+}
+
+static void observer_sub_cb(void *arg, err_t err) {
+  observer_subscribed = err == ERR_OK;
+}
+
+static void observer_publish_cb(void *arg, const char *topic, u32_t tot_len) {
+  rx.clear();
+}
+
+static void observer_data_cb(void *arg, const u8_t *data, u16_t len, u8_t flags) {
+  rx.append((const char *)data, len);
+  if (flags & MQTT_DATA_FLAG_LAST) state = rx;
+}
+
+static void observer_connect() {
+  mqtt_connect_client_info_t ci = {};
+  ci.client_id = "test_iot_observer";
+  ci.keep_alive = 10;
+#ifdef MQTT_TLS
+  ci.tls_config = observer_tls;
+#endif
+  ip_addr_t addr;
+  ip4addr_aton("127.0.0.1", &addr);
+  observer_up = observer_subscribed = false;
+  CHECK(mqtt_client_connect(observer, &addr, port, observer_connection_cb, nullptr, &ci) == ERR_OK);
+}
+
+// step runs the network and IOT once, with the virtual clock roughly keeping up with the broker's
+static void step() {
+  cyw43_arch_poll();
+  iot.loop();
+  usleep(2000);
+  sleep_ms(2);
+}
+
+// run_until steps until done() or the timeout (virtual ms), and returns done()
+template <typename F>
+static bool run_until(F done, uint32_t timeout_ms) {
+  absolute_time_t until = make_timeout_time_ms(timeout_ms);
+  while (!done()) {
+    if (absolute_time_diff_us(get_absolute_time(), until) < 0) return false;
+    step();
+  }
+  return true;
+}
+
+// burst sends n commands of three fragments each while the board's main loop is busy (only the network runs): the
+// board must get the last one, and only that one
+static bool burst(int n) {
+  std::string pad(300, ' ');
+  std::string last;
+  for (int i = 0; i < n; i++) {
+    last = "{\"brightness\":" + std::to_string(i) + "," + pad + "\"state\":\"ON\"}";
+    CHECK(mqtt_publish(observer, command_topic.c_str(), last.data(), last.size(), 1, 0, nullptr, nullptr) == ERR_OK);
+    for (int j = 0; j < 20; j++) { // an ack frees a request slot
+      cyw43_arch_poll();
+      usleep(500);
+    }
+  }
+  for (int j = 0; j < 200; j++) {
+    cyw43_arch_poll();
+    usleep(500);
+  }
+
+  command.clear();
+  commands = 0;
+  iot.loop();
+  return commands == 1 && command == last;
+}
+
+// the network cache, as iot.h's net_cache_t lays it out in flash
+
+typedef struct {
+    char magic[8];
+    uint32_t size;
+    uint32_t ssid_hash;
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint32_t ip, netmask, gw, dns;
+    uint32_t broker_addr[4];
+} net_cache_t;
+
+static net_cache_t *flash_cache() {
+  return (net_cache_t *)(XIP_BASE + WIFI_CACHE_FLASH_OFFSET);
+}
+
+static const uint8_t sim_bssid[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+static const uint8_t moved_bssid[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x02};
+
+// boot starts a fresh board in a child process: it sets up the flash and network, joins ssid, and once it's connected
+// and had the time to cache its network settings, returns check() and the cache it left in flash
+template <typename S, typename C>
+static bool boot(const char *ssid, S setup, C check, net_cache_t *cache) {
+  int fds[2];
+  if (pipe(fds) != 0) return false;
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    setup();
+    bool ok = iot.init(ssid, "", CYW43_AUTH_WPA2_AES_PSK, [] {}, [](const char *, size_t) {}, nullptr) == 0 &&
+              iot.connect() == 0 && run_until([] { return iot.is_connected(); }, 20000);
+    run_until([] { return false; }, 100);
+    ok = ok && check();
+    ok = write(fds[1], flash_cache(), sizeof(net_cache_t)) == sizeof(net_cache_t) && ok;
+    fflush(stdout);
+    _exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+  }
+  close(fds[1]);
+  bool read_all = pid > 0 && read(fds[0], cache, sizeof(net_cache_t)) == sizeof(net_cache_t);
+  close(fds[0]);
+  int status = 0;
+  if (pid > 0) waitpid(pid, &status, 0);
+  return read_all && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+// net_cache boots boards with and without a valid cache
+static void net_cache() {
+  static net_cache_t cache, saved, c;
+  auto erased = [] {};
+  auto cached = [] { memcpy(flash_cache(), &c, sizeof(c)); };
+  auto scanned_and_looked_up = [] {
+    return sim::joins().size() == 1 && !sim::joins()[0].fast && sim::dns_lookups() == 1;
+  };
+
+  // nothing cached
+  CHECK(boot("sim", erased, scanned_and_looked_up, &cache));
+  CHECK(memcmp(cache.magic, "NETCACHE", sizeof(cache.magic)) == 0);
+  CHECK(cache.size == sizeof(cache));
+  CHECK(memcmp(cache.bssid, sim_bssid, sizeof(sim_bssid)) == 0 && cache.channel == 6);
+  CHECK(cache.ip == htonl(INADDR_LOOPBACK));
+  CHECK(cache.broker_addr[0] == htonl(INADDR_LOOPBACK));
+  saved = cache;
+
+  // cached: no scan, no lookup, and nothing to write
+  c = saved;
+  CHECK(boot("sim", cached, [] {
+    auto &j = sim::joins();
+    return j.size() == 1 && j[0].fast && memcmp(j[0].bssid, sim_bssid, sizeof(sim_bssid)) == 0 && j[0].channel == 6 &&
+           sim::dns_lookups() == 0;
+  }, &cache));
+  CHECK(memcmp(&cache, &saved, sizeof(cache)) == 0);
+
+  // not a cache, a cache of another layout, or of another network
+  c = saved;
+  c.magic[0] = 'X';
+  CHECK(boot("sim", cached, scanned_and_looked_up, &cache));
+  CHECK(memcmp(&cache, &saved, sizeof(cache)) == 0);
+  c = saved;
+  c.size--;
+  CHECK(boot("sim", cached, scanned_and_looked_up, &cache));
+  c = saved;
+  CHECK(boot("another sim", cached, scanned_and_looked_up, &cache));
+  CHECK(cache.ssid_hash != saved.ssid_hash);
+
+  // the access point moved: the fast join gets no answer, and the board scans after WIFI_FAST_JOIN_TIMEOUT_MS
+  c = saved;
+  CHECK(boot("sim", [] {
+    memcpy(flash_cache(), &c, sizeof(c));
+    sim::set_access_point(moved_bssid, 11);
+  }, [] {
+    auto &j = sim::joins();
+    return j.size() == 2 && j[0].fast && !j[1].fast && j[1].time_us - j[0].time_us >= WIFI_FAST_JOIN_TIMEOUT_MS * 1000ull &&
+           j[1].time_us - j[0].time_us < WIFI_JOIN_TIMEOUT_MS * 1000ull && sim::dns_lookups() == 0;
+  }, &cache));
+  CHECK(memcmp(cache.bssid, moved_bssid, sizeof(moved_bssid)) == 0 && cache.channel == 11);
+
+  // the broker's cached address doesn't answer: it's looked up again, and the new one cached
+  c = saved;
+  c.broker_addr[0] = htonl(INADDR_LOOPBACK + 1);
+  CHECK(boot("sim", cached, [] { return sim::joins().size() == 1 && sim::dns_lookups() == 1; }, &cache));
+  CHECK(cache.broker_addr[0] == htonl(INADDR_LOOPBACK));
+}
+
+// observe connects the observer and subscribes it to the board's state
+static bool observe() {
+  observer_connect();
+  if (!run_until([] { return observer_up; }, 5000)) return false;
+  mqtt_set_inpub_callback(observer, observer_publish_cb, observer_data_cb, nullptr);
+  CHECK(mqtt_subscribe(observer, state_topic.c_str(), 1, observer_sub_cb, nullptr) == ERR_OK);
+  return run_until([] { return observer_subscribed; }, 5000);
+}
+
+// send_command publishes a command until the board gets it: its subscription may not be in place yet
+static bool send_command(const char *cmd) {
+  command.clear();
+  for (int i = 0; i < 20; i++) {
+    CHECK(mqtt_publish(observer, command_topic.c_str(), cmd, strlen(cmd), 1, 0, nullptr, nullptr) == ERR_OK);
+    if (run_until([] { return !command.empty(); }, 250)) return command == cmd;
+  }
+  return false;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 3 && argc != 5) {
+    printf("usage: %s <mosquitto> <port> [<cert> <key>]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  mosquitto = argv[1];
+  port = strtoul(argv[2], nullptr, 10);
+  if (argc == 5) {
+    cert_file = argv[3];
+    key_file = argv[4];
+  }
+#ifdef MQTT_TLS
+  if (cert_file == nullptr || !read_cert()) {
+    printf("%s: needs the broker's certificate and key\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  observer_tls = altcp_tls_create_config_client((const u8_t *)test_broker_cert, strlen(test_broker_cert) + 1);
+  CHECK(observer_tls != nullptr);
+#endif
+  atexit(stop_broker);
+  if (!start_broker()) return EXIT_FAILURE;
+  net_cache();
+
+  char board_id[32];
+  pico_get_unique_board_id_string(board_id, sizeof(board_id));
+  state_topic = std::string(MQTT_TOPIC_PREFIX) + board_id;
+  command_topic = state_topic + "/set";
+  observer = mqtt_client_new();
+  CHECK(observe());
+
+  CHECK(iot.init("sim", "", CYW43_AUTH_WPA2_AES_PSK, on_connect, on_command, nullptr) == 0);
+  CHECK(iot.connect() == 0);
+  CHECK(run_until([] { return iot.is_connected(); }, 10000));
+  CHECK(run_until([] { return state == "{\"state\":\"one\"}"; }, 5000));
+  CHECK(send_command("{\"state\":\"ON\"}"));
+  CHECK(burst(30));
+  CHECK(iot.get_coalesced_messages() == 29);
+
+  // the broker goes away: IOT notices, and keeps what's published until it's back
+  stop_broker();
+  CHECK(run_until([] { return !iot.is_connected(); }, 5000));
+  CHECK(iot.publish_state("{\"state\":\"two\"}") == 0);
+  run_until([] { return false; }, 1500); // a failed attempt or two
+  CHECK(!iot.is_connected());
+
+  CHECK(start_broker());
+  CHECK(observe());
+  CHECK(run_until([] { return iot.is_connected(); }, 70000)); // the backoff is up to a minute
+  CHECK(connects == 2);
+  CHECK(run_until([] { return state == "{\"state\":\"two\"}"; }, 5000));
+  CHECK(send_command("{\"state\":\"OFF\"}"));
+
+  auto stats = iot.get_publish_stats();
+  CHECK(stats.sent == 2);
+  CHECK(iot.get_dropped_messages() == 0);
+#ifdef MQTT_TLS
+  // the second connection offered the first one's session (the broker restarted, so it may not have resumed it)
+  auto ts = iot.get_tls_stats();
+  CHECK(ts.handshakes == 2);
+  CHECK(ts.resumes_offered == 1);
+#endif
+
+  stop_broker();
+  if (failures) return EXIT_FAILURE;
+  printf("ok\n");
+  return EXIT_SUCCESS;
+}
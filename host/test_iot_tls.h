@@ -0,0 +1,7 @@
+#pragma once
+// test_iot_tls: test_iot with MQTT_TLS, trusting the test broker's certificate (test_broker.crt), which test_iot reads
+// from the file it's given before connecting. Included ahead of every source, see CMakeLists.txt.
+
+#define MQTT_TLS
+extern char test_broker_cert[4096];
+#define MQTT_TLS_CERT test_broker_cert
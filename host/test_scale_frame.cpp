@@ -0,0 +1,69 @@
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "render.h"
+
+// render::scale_frame: the scaled words, and a hash that changes with any change to the frame, including changes
+// confined to the top byte of the words (green in GRB order), which update_strip would otherwise skip as unchanged.
+
+using namespace ledcontrol;
+
+static uint32_t rng = 4242;
+
+static uint32_t next_random() {
+  rng ^= rng << 13; rng ^= rng >> 17; rng ^= rng << 5; // xorshift32
+  return rng;
+}
+
+static int failures = 0;
+
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+static uint32_t hash(const std::vector<uint32_t> &frame, uint32_t scale = 256) {
+  std::vector<uint32_t> out(frame.size());
+  return render::scale_frame(frame.data(), out.data(), frame.size(), scale);
+}
+
+int main() {
+  static const uint32_t LEDS[] = {2, 3, 60, 300};
+
+  for (auto leds : LEDS) {
+    std::vector<uint32_t> frame(leds), out(leds);
+    for (auto &px : frame) px = next_random();
+
+    // the output words
+    for (uint32_t scale : {0u, 1u, 128u, 255u, 256u}) {
+      render::scale_frame(frame.data(), out.data(), leds, scale);
+      for (uint32_t i = 0; i < leds; i++) CHECK(out[i] == render::scale_swar(frame[i], scale));
+    }
+
+    uint32_t base = hash(frame);
+    CHECK(hash(frame) == base);
+
+    // only the top byte of two pixels changes: the same bit 31 in both, and random values
+    for (uint32_t n = 0; n < 20000; n++) {
+      auto changed = frame;
+      uint32_t a = next_random() % leds, b = (a + 1 + next_random() % (leds - 1)) % leds;
+      if (n < leds * leds) {
+        a = n / leds;
+        b = n % leds;
+        if (a == b) continue;
+        changed[a] ^= 0x80000000;
+        changed[b] ^= 0x80000000;
+      } else {
+        changed[a] ^= (1 + next_random() % 255) << 24;
+        changed[b] ^= (1 + next_random() % 255) << 24;
+      }
+      if (hash(changed) == base) {
+        printf("%u leds: pixels %u and %u changed, same hash\n", leds, a, b);
+        failures++;
+        break;
+      }
+    }
+  }
+
+  if (failures) return EXIT_FAILURE;
+  printf("ok\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,77 @@
+#include <cstdio>
+#include <cstdlib>
+#include <atomic>
+#include <thread>
+
+#include "seqlock.h"
+
+// SeqLock tests: the value before any store, the last value stored, and a writer thread storing while the reader
+// checks every value it loads is one that was stored whole.
+
+static int failures = 0;
+
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+// words and a 64-bit counter that all have to come from the same store, big enough that a load overlapping a store
+// shows up as a torn value
+typedef struct {
+    uint32_t seq;
+    uint32_t words[61];
+    uint64_t wide;
+} value_t;
+
+static value_t make(uint32_t i) {
+  value_t v;
+  v.seq = i;
+  for (auto &w : v.words) w = i * 2654435761u;
+  v.wide = (uint64_t)~i << 32 | i;
+  return v;
+}
+
+static bool whole(const value_t &v) {
+  for (auto w : v.words) if (w != v.seq * 2654435761u) return false;
+  return v.wide == ((uint64_t)~v.seq << 32 | v.seq);
+}
+
+static void test_store_load() {
+  SeqLock<value_t> l;
+  auto v = l.load();
+  CHECK(v.seq == 0 && v.wide == 0);
+  l.store(make(1));
+  l.store(make(2));
+  v = l.load();
+  CHECK(v.seq == 2 && whole(v));
+}
+
+static void test_threads() {
+  static SeqLock<value_t> l;
+  const uint32_t count = 2000000;
+  l.store(make(0));
+  std::atomic<bool> done{false};
+  std::thread writer([&] {
+    for (uint32_t i = 1; i <= count; i++) l.store(make(i));
+    done.store(true);
+  });
+  uint32_t last = 0, bad = 0, backwards = 0, loads = 0;
+  while (!done.load()) {
+    auto v = l.load();
+    if (!whole(v)) bad++;
+    if (v.seq < last) backwards++;
+    last = v.seq;
+    loads++;
+  }
+  writer.join();
+  auto v = l.load();
+  CHECK(bad == 0);
+  CHECK(backwards == 0);
+  CHECK(v.seq == count && whole(v));
+  CHECK(loads > 0);
+}
+
+int main() {
+  test_store_load();
+  test_threads();
+  if (failures) return EXIT_FAILURE;
+  printf("ok\n");
+  return EXIT_SUCCESS;
+}
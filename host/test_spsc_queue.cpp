@@ -0,0 +1,94 @@
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+#include "spsc_queue.h"
+
+// SPSCQueue tests: empty and full, FIFO order, index wraparound, and a producer and a consumer thread hammering it.
+
+static int failures = 0;
+
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+static void test_empty_full() {
+  SPSCQueue<int, 4> q;
+  int v = -1;
+  CHECK(q.empty());
+  CHECK(!q.pop(&v));
+  CHECK(v == -1); // untouched
+  for (int i = 0; i < 4; i++) CHECK(q.push(i));
+  CHECK(!q.empty());
+  CHECK(!q.push(4));
+  CHECK(q.pop(&v) && v == 0);
+  CHECK(q.push(4)); // room again
+  CHECK(!q.push(5));
+  for (int i = 1; i <= 4; i++) CHECK(q.pop(&v) && v == i);
+  CHECK(q.empty());
+  CHECK(!q.pop(&v));
+}
+
+static void test_fifo() {
+  SPSCQueue<int, 16> q;
+  int v;
+  for (int i = 0; i < 10; i++) CHECK(q.push(i));
+  for (int i = 0; i < 5; i++) CHECK(q.pop(&v) && v == i);
+  for (int i = 10; i < 20; i++) CHECK(q.push(i));
+  for (int i = 5; i < 20; i++) CHECK(q.pop(&v) && v == i);
+  CHECK(q.empty());
+}
+
+// every fill level, at every offset into the buffer, many times round it
+static void test_wraparound() {
+  SPSCQueue<uint32_t, 8> q;
+  uint32_t in = 0, out = 0, v;
+  for (int round = 0; round < 1000; round++) {
+    uint32_t n = round % 9;
+    for (uint32_t i = 0; i < n; i++) CHECK(q.push(in++));
+    if (n == 8) CHECK(!q.push(in));
+    for (uint32_t i = 0; i < n; i++) CHECK(q.pop(&v) && v == out++);
+    CHECK(q.empty());
+  }
+}
+
+// items bigger than a word, so a pop that overtakes the push copying it shows up as a torn item
+typedef struct {
+    uint32_t seq;
+    uint32_t words[7];
+} item_t;
+
+static void test_threads() {
+  static SPSCQueue<item_t, 16> q;
+  const uint32_t count = 2000000;
+  std::thread producer([&] {
+    for (uint32_t i = 0; i < count; i++) {
+      item_t it;
+      it.seq = i;
+      for (auto &w : it.words) w = i * 2654435761u;
+      while (!q.push(it)) std::this_thread::yield();
+    }
+  });
+  uint32_t next = 0, bad = 0;
+  while (next < count) {
+    item_t it;
+    if (!q.pop(&it)) {
+      std::this_thread::yield();
+      continue;
+    }
+    if (it.seq != next) bad++;
+    for (auto w : it.words) if (w != next * 2654435761u) bad++;
+    next++;
+  }
+  producer.join();
+  CHECK(bad == 0);
+  CHECK(q.empty());
+}
+
+int main() {
+  test_empty_full();
+  test_fifo();
+  test_wraparound();
+  test_threads();
+  if (failures) return EXIT_FAILURE;
+  printf("ok\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,72 @@
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "render.h"
+
+// render::transpose_planes (and transpose8 under it) against a bit-by-bit reference: 1 to 8 strips, RGB and RGBW
+// words, strip lengths that aren't a multiple of anything.
+
+using namespace ledcontrol;
+
+static uint32_t rng = 12345;
+
+static uint32_t next_random() {
+  rng ^= rng << 13; rng ^= rng >> 17; rng ^= rng << 5; // xorshift32
+  return rng;
+}
+
+// reference_planes is what transpose_planes documents, one bit at a time
+static std::vector<uint8_t> reference_planes(const std::vector<uint32_t> &src, uint32_t leds_per_strip, uint32_t strips,
+                                             uint32_t bytes) {
+  std::vector<uint8_t> dst(leds_per_strip * bytes * 8, 0);
+  for (uint32_t i = 0; i < leds_per_strip; i++) {
+    for (uint32_t bit = 0; bit < bytes * 8; bit++) {
+      uint8_t &out = dst[i * bytes * 8 + bit];
+      for (uint32_t s = 0; s < strips; s++) {
+        if ((src[s * leds_per_strip + i] >> (31 - bit)) & 1) out |= 1 << s;
+      }
+    }
+  }
+  return dst;
+}
+
+int main() {
+  static const uint32_t LEDS_PER_STRIP[] = {1, 2, 3, 7, 13, 60, 97};
+  int failures = 0;
+
+  for (uint32_t bytes = 3; bytes <= 4; bytes++) {
+    for (uint32_t strips = 1; strips <= 8; strips++) {
+      for (auto leds_per_strip : LEDS_PER_STRIP) {
+        std::vector<uint32_t> src(strips * leds_per_strip);
+        for (auto &px : src) {
+          px = next_random();
+          if (bytes == 3) px &= 0xFFFFFF00; // RGB words never have white
+        }
+        // the first and last LEDs all on, so a bit landing in the wrong strip or time can't hide behind a zero
+        src[0] = src[src.size() - 1] = 0xFFFFFFFF;
+
+        std::vector<uint8_t> dst(leds_per_strip * bytes * 8 + 1, 0xA5); // +1: must not be written
+        render::transpose_planes(src.data(), dst.data(), leds_per_strip, strips, bytes);
+        auto expected = reference_planes(src, leds_per_strip, strips, bytes);
+
+        for (size_t j = 0; j < expected.size(); j++) {
+          if (dst[j] != expected[j]) {
+            printf("%s, %u strips of %u LEDs: byte %zu is %02x, expected %02x\n", bytes == 4 ? "RGBW" : "RGB", strips,
+                   leds_per_strip, j, dst[j], expected[j]);
+            failures++;
+            break;
+          }
+        }
+        if (dst.back() != 0xA5) {
+          printf("%s, %u strips of %u LEDs: wrote past the end\n", bytes == 4 ? "RGBW" : "RGB", strips, leds_per_strip);
+          failures++;
+        }
+      }
+    }
+  }
+
+  if (failures) return EXIT_FAILURE;
+  printf("ok\n");
+  return EXIT_SUCCESS;
+}
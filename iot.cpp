@@ -2,7 +2,20 @@
 #include <cstdio>
 #include <string.h>
 #include <time.h>
+#include <algorithm>
 #include "pico/unique_id.h"
+#include "profile.h"
+#include "logging.h"
+#include "boot.h"
+#include "frameclock.h"
+#include "lwip/dhcp.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "pico/multicore.h"
+#ifdef MQTT_TLS
+#include <malloc.h>
+#include "lwip/apps/mqtt_priv.h"
+#endif
 
 #ifdef MQTT_TLS
 #ifdef MQTT_TLS_CERT
@@ -18,25 +31,58 @@ const char *key = MQTT_TLS_KEY;
 
 extern cyw43_t cyw43_state;
 
+// brokers to try in turn, see MQTT_SERVERS
+static const struct {
+    const char *host;
+    uint16_t port;
+} brokers[] = MQTT_SERVERS;
+static const uint8_t BROKER_COUNT = sizeof(brokers) / sizeof(brokers[0]);
+
+static const char net_cache_magic[8] = {'N', 'E', 'T', 'C', 'A', 'C', 'H', 'E'};
+
+static uint32_t fnv1a(const char *s) {
+  uint32_t h = 2166136261u;
+  for (; *s != '\0'; s++) h = (h ^ (uint8_t)*s) * 16777619u;
+  return h;
+}
+
+#ifdef MQTT_TLS
+// heap_in_use is how much of the heap is allocated, in bytes
+static uint32_t heap_in_use() {
+  return mallinfo().uordblks;
+}
+#endif
+
+static bool net_static() {
+#ifdef WIFI_STATIC_IP
+  return true;
+#else
+  return false;
+#endif
+}
+
 IOT::IOT():
 global_state(NULL),
+outbox{},
 state_topic{0},
 command_topic{0},
 config_topic{0},
 save_state_topic{0},
 save_command_topic{0},
 save_config_topic{0},
+diag_topic{0},
+diag_config_topic{0},
 _connect_cb(NULL),
-_loop_cb(NULL),
-_command_cb(NULL),
-_save_command_cb(NULL){
+subscriptions{},
+inbox{}{
 }
 
-int IOT::init(const char *ssid, const char *password, uint32_t authmode, void (*loop_cb)(), void (*connect_cb)(), void (*command_cb)(const char *data, size_t len), void (*save_command_cb)(const char *data, size_t len)) {
-  _loop_cb = loop_cb;
+// init starts joining WiFi, and returns without waiting for it: connect() and loop() take it from there
+int IOT::init(const char *ssid, const char *password, uint32_t authmode, void (*connect_cb)(), void (*command_cb)(const char *data, size_t len), void (*save_command_cb)(const char *data, size_t len)) {
   _connect_cb = connect_cb;
-  _command_cb = command_cb;
-  _save_command_cb = save_command_cb;
+  _ssid = ssid;
+  _password = password;
+  _authmode = authmode;
 
   get_topic_name(state_topic, sizeof(state_topic), "", "");
   get_topic_name(command_topic, sizeof(command_topic), "", "/set");
@@ -46,120 +92,364 @@ int IOT::init(const char *ssid, const char *password, uint32_t authmode, void (*
   get_topic_name(save_command_topic, sizeof(save_command_topic), "", "_save/set");
   get_topic_name(save_config_topic, sizeof(save_config_topic), MQTT_HOME_ASSISTANT_DISCOVERY_PREFIX, "_save/config");
 
-  cyw43_arch_enable_sta_mode();
+  get_topic_name(diag_topic, sizeof(diag_topic), "", "/diag");
+  get_topic_name(diag_config_topic, sizeof(diag_config_topic), MQTT_HOME_ASSISTANT_SENSOR_DISCOVERY_PREFIX, "_diag/config");
 
-  printf("[wifi] connecting...\n");
-  if (cyw43_arch_wifi_connect_async(ssid, password, authmode)) {
-    printf("[wifi] failed to start connection\n");
-    return -1;
-  }
+  init_outbox(OUT_CONFIG, config_topic, MQTT_CONFIG_QOS, 1, config_buf, sizeof(config_buf));
+  init_outbox(OUT_SAVE_CONFIG, save_config_topic, MQTT_CONFIG_QOS, 1, save_config_buf, sizeof(save_config_buf));
+  init_outbox(OUT_DIAG_CONFIG, diag_config_topic, MQTT_CONFIG_QOS, 1, diag_config_buf, sizeof(diag_config_buf));
+  init_outbox(OUT_STATE, state_topic, MQTT_STATE_QOS, 1, state_buf, sizeof(state_buf));
+  init_outbox(OUT_DIAG, diag_topic, MQTT_DIAGNOSTICS_QOS, 0, diag_buf, sizeof(diag_buf));
 
-  while(true) {
-    int res = cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA);
-    if (res >= CYW43_LINK_UP) break;
-    if (res < 0) {
-      printf("[wifi] failed to connect: %d\n", res);
-      return -2;
-    }
-    poll_wifi();
-  }
+  topic_prefix_len = strlen(state_topic);
+  for (auto &i : sub_index) i = SUB_NONE;
+  init_subscription(SUB_COMMAND, command_topic, 2, command_cb);
+  init_subscription(SUB_SAVE_COMMAND, save_command_topic, 2, save_command_cb);
 
-  printf("[wifi] connected\n");
   printf("[mqtt] state topic: %s\n[mqtt] command topic: %s\n[mqtt] config topic: %s\n", state_topic, command_topic, config_topic);
   printf("[mqtt] [save] state topic: %s\n[mqtt] command topic: %s\n[mqtt] config topic: %s\n", save_state_topic, save_command_topic, save_config_topic);
+  printf("[mqtt] [diag] state topic: %s\n[mqtt] config topic: %s\n", diag_topic, diag_config_topic);
+
+  load_net_cache();
+  cyw43_arch_enable_sta_mode();
+  printf("[wifi] connecting...\n");
+  if (join() != 0) return -1;
   return 0;
 }
 
+// connect starts connecting to the broker. loop() does the work, and keeps reconnecting whenever the connection or
+// the WiFi link is lost.
 int IOT::connect() {
-  mqtt_wrapper_t *state = new mqtt_wrapper_t();
-  state->mqtt_client = NULL;
-  int res = mqtt_fresh_state(MQTT_SERVER_HOST, MQTT_SERVER_PORT, state);
-  if (res != 0) {
-    printf("[mqtt] failed to init: %d\n", res);
-    return res;
+  if (global_state == NULL) {
+    global_state = new mqtt_wrapper_t();
+    global_state->mqtt_client = NULL;
   }
-  global_state = state;
 
-  // caller should do cyw43_arch_poll() in a loop if using pico_cyw43_arch_lwip_poll
+  set_conn_state(CONN_LINK_DOWN); // goes on to the lookup as soon as the link is up
+  return 0;
+}
+
+// join starts joining the access point: the cached one if there's one, without a scan. The link status tells how it
+// goes.
+int IOT::join() {
+  join_at = to_ms_since_boot(get_absolute_time());
+  addr_applied = false;
+  fast_join = net_cache.channel != 0 && !skip_fast_join;
+
+  int err;
+  if (fast_join) {
+    LOG_INFO("[wifi] joining %02x:%02x:%02x:%02x:%02x:%02x on channel %u\n", net_cache.bssid[0], net_cache.bssid[1],
+             net_cache.bssid[2], net_cache.bssid[3], net_cache.bssid[4], net_cache.bssid[5], net_cache.channel);
+    cyw43_arch_lwip_begin();
+    err = cyw43_wifi_join(&cyw43_state, strlen(_ssid), (const uint8_t *)_ssid, _password ? strlen(_password) : 0,
+                          (const uint8_t *)_password, _authmode, net_cache.bssid, net_cache.channel);
+    cyw43_arch_lwip_end();
+  } else {
+    err = cyw43_arch_wifi_connect_async(_ssid, _password, _authmode);
+  }
 
+  if (err) {
+    LOG_WARN("[wifi] failed to start connection: %d\n", err);
+    return -1;
+  }
   return 0;
 }
 
-void IOT::poll_wifi(uint32_t min_sleep_ms) {
-  uint32_t start_time = to_ms_since_boot(get_absolute_time());
-  uint32_t last_time;
-  do {
-#if PICO_CYW43_ARCH_POLL
-    cyw43_arch_poll();
-    sleep_ms(1);
+// apply_address sets the static address, or the cached lease's, as soon as we've joined: DHCP would take seconds. With
+// the cached lease, DHCP still runs, and if it hands out another address the connection is remade on that.
+void IOT::apply_address() {
+  addr_applied = true;
+  struct netif *n = &cyw43_state.netif[CYW43_ITF_STA];
+
+#ifdef WIFI_STATIC_IP
+  ip4_addr_t ip, netmask, gw;
+  ip4addr_aton(WIFI_STATIC_IP, &ip);
+  ip4addr_aton(WIFI_STATIC_NETMASK, &netmask);
+  ip4addr_aton(WIFI_STATIC_GATEWAY, &gw);
+  cyw43_arch_lwip_begin();
+  dhcp_stop(n);
+  netif_set_addr(n, &ip, &netmask, &gw);
+#ifdef WIFI_STATIC_DNS
+  ip_addr_t dns;
+  ip4addr_aton(WIFI_STATIC_DNS, &dns);
+  dns_setserver(0, &dns);
+#endif
+  cyw43_arch_lwip_end();
+  LOG_INFO("[wifi] static address %s\n", WIFI_STATIC_IP);
+#elif defined(WIFI_REUSE_LEASE)
+  if (net_cache.ip == 0) return;
+  ip4_addr_t ip, netmask, gw;
+  ip_addr_t dns;
+  ip4_addr_set_u32(&ip, net_cache.ip);
+  ip4_addr_set_u32(&netmask, net_cache.netmask);
+  ip4_addr_set_u32(&gw, net_cache.gw);
+  ip4_addr_set_u32(&dns, net_cache.dns);
+  cyw43_arch_lwip_begin();
+  netif_set_addr(n, &ip, &netmask, &gw);
+  if (net_cache.dns != 0) dns_setserver(0, &dns);
+  cyw43_arch_lwip_end();
+  LOG_INFO("[wifi] reusing address %s\n", ip4addr_ntoa(&ip));
+#else
+  (void)n;
 #endif
-    if (_loop_cb != NULL) (*_loop_cb)();
-    last_time = to_ms_since_boot(get_absolute_time());
-  } while(start_time + min_sleep_ms > last_time);
 }
 
-void IOT::_dns_found_cb(const char *name, const ip_addr_t *ipaddr, void *callback_arg) {
-  printf("[dns] found! %s\n", ip4addr_ntoa(ipaddr));
-  auto ip = (ip_addr_t*)callback_arg;
-  *ip = *ipaddr;
+// load_net_cache reads the cached network settings from flash, if they're for this network
+void IOT::load_net_cache() {
+  memset(&net_cache, 0, sizeof(net_cache));
+
+  net_cache_t c;
+  memcpy(&c, (const void *)(XIP_BASE + WIFI_CACHE_FLASH_OFFSET), sizeof(c));
+  if (memcmp(c.magic, net_cache_magic, sizeof(c.magic)) != 0 || c.size != sizeof(c) || c.ssid_hash != fnv1a(_ssid)) {
+    LOG_INFO("[wifi] no cached network settings\n");
+    return;
+  }
+  net_cache = c;
 }
 
-// run_dns_lookup tries to resolve the given host and set it to addr
-int IOT::run_dns_lookup(const char *host, ip_addr_t *addr) {
-  addr->addr = 0;
-  printf("[dns] looking up %s\n", host);
+// update_net_cache saves this connection's network settings to flash, if they changed. Erasing the sector pauses
+// rendering for a few tens of ms, so this only happens when we join another access point, get another lease or a
+// broker moves.
+void IOT::update_net_cache() {
+  net_cache_t c = net_cache;
+  memcpy(c.magic, net_cache_magic, sizeof(c.magic));
+  c.size = sizeof(c);
+  c.ssid_hash = fnv1a(_ssid);
 
+  uint32_t channel = 0;
   cyw43_arch_lwip_begin();
-  err_t err = dns_gethostbyname(host, addr, _iot_dns_found_cb, addr);
+  cyw43_wifi_get_bssid(&cyw43_state, c.bssid);
+  cyw43_ioctl(&cyw43_state, CYW43_IOCTL_GET_CHANNEL, sizeof(channel), (uint8_t *)&channel, CYW43_ITF_STA);
+  struct netif *n = &cyw43_state.netif[CYW43_ITF_STA];
+  if (dhcp_supplied_address(n)) {
+    c.ip = ip4_addr_get_u32(netif_ip4_addr(n));
+    c.netmask = ip4_addr_get_u32(netif_ip4_netmask(n));
+    c.gw = ip4_addr_get_u32(netif_ip4_gw(n));
+    c.dns = ip4_addr_get_u32(dns_getserver(0));
+  }
   cyw43_arch_lwip_end();
+  c.channel = channel;
+  if (broker < CACHED_BROKERS) c.broker_addr[broker] = ip4_addr_get_u32(&broker_addr);
+
+  if (memcmp(&c, &net_cache, sizeof(c)) == 0) return;
+  net_cache = c;
+
+  uint8_t buffer[FLASH_PAGE_SIZE];
+  static_assert(sizeof(c) <= sizeof(buffer), "net_cache_t doesn't fit a flash page");
+  memset(buffer, 0xff, sizeof(buffer));
+  memcpy(buffer, &c, sizeof(c));
+
+  // core1 renders from flash (XIP), park it in RAM for the duration
+  multicore_lockout_start_blocking();
+  uint32_t ints = save_and_disable_interrupts();
+  flash_range_erase(WIFI_CACHE_FLASH_OFFSET, FLASH_SECTOR_SIZE);
+  flash_range_program(WIFI_CACHE_FLASH_OFFSET, buffer, sizeof(buffer));
+  restore_interrupts(ints);
+  multicore_lockout_end_blocking();
+  LOG_INFO("[wifi] network settings cached\n");
+}
 
-  if (err == ERR_ARG) {
-    printf("[dns] failed to start query\n");
-    return -1;
+void IOT::_dns_found_cb(const char *name, const ip_addr_t *ipaddr, void *callback_arg) {
+  control.dns_found = ipaddr != NULL;
+  if (ipaddr != NULL) control.dns_addr = *ipaddr;
+  for (control.dns_broker = 0; control.dns_broker < BROKER_COUNT && strcmp(name, brokers[control.dns_broker].host) != 0; control.dns_broker++);
+  control.dns_done = true;
+  frame_clock.wake();
+}
+
+// start_lookup starts resolving the current broker, unless its address is cached. The result is picked up by
+// step_connection.
+void IOT::start_lookup() {
+  const char *host = brokers[broker].host;
+  set_conn_state(CONN_DNS);
+  dns_result = 0;
+
+#ifdef MQTT_CACHE_BROKER_ADDR
+  if (broker < CACHED_BROKERS && net_cache.broker_addr[broker] != 0 && !(stale_brokers & (1 << broker))) {
+    ip4_addr_set_u32(&broker_addr, net_cache.broker_addr[broker]);
+    LOG_INFO("[dns] using cached address of %s\n", host);
+    dns_result = 1;
+    return;
   }
+#endif
+
+  LOG_INFO("[dns] looking up %s\n", host);
+
+  cyw43_arch_lwip_begin();
+  err_t err = dns_gethostbyname(host, &broker_addr, _iot_dns_found_cb, NULL);
+  cyw43_arch_lwip_end();
 
   if (err == ERR_OK) {
-    printf("[dns] no lookup needed\n");
-    // addr was already written to from the cache, nothing to do
-    return 0;
+    dns_result = 1; // cached, or an ip address already
+  } else if (err != ERR_INPROGRESS) {
+    LOG_WARN("[dns] failed to start query: %d\n", err);
+    dns_result = -1;
   }
+}
 
-  while (addr->addr == 0) poll_wifi();
-  return 0;
+// requeue_in_flight queues what was in flight again: lwIP drops the requests of a closed connection without calling
+// back
+void IOT::requeue_in_flight() {
+  for (auto &out : outbox) {
+    if (!out.in_flight) continue;
+    out.in_flight = false;
+    out.pending = true;
+  }
+  in_flight = 0;
 }
 
 void IOT::mqtt_disconnect_and_free(mqtt_wrapper_t *state) {
+  requeue_in_flight();
   if (!state->mqtt_client) return;
 
+  cyw43_arch_lwip_begin();
   mqtt_disconnect(state->mqtt_client);
   mqtt_client_free(state->mqtt_client);
+  cyw43_arch_lwip_end();
   state->mqtt_client = NULL;
 }
 
-int IOT::mqtt_fresh_state(const char *mqtt_host, uint16_t mqtt_port, mqtt_wrapper_t *state) {
-  // clean up previous state
-  mqtt_disconnect_and_free(state);
+// start_connect connects to the resolved broker with a fresh client
+void IOT::start_connect() {
+  LOG_INFO("[mqtt] connecting to %s (%s) port %u\n", brokers[broker].host, ip4addr_ntoa(&broker_addr), brokers[broker].port);
+  set_conn_state(CONN_CONNECTING);
+  conn_event = false;
 
-  state->mqtt_client = mqtt_client_new();
-  if (state->mqtt_client == NULL) {
-    printf("[mqtt] failed to create client\n");
-    return -1;
+  mqtt_disconnect_and_free(global_state);
+  client_gen++;
+  cyw43_arch_lwip_begin();
+  global_state->mqtt_client = mqtt_client_new();
+  cyw43_arch_lwip_end();
+  if (global_state->mqtt_client == NULL) {
+    LOG_ERROR("[mqtt] failed to create client\n");
+    connection_failed();
+    return;
   }
 
-  ip_addr_t host_addr;
-  if (run_dns_lookup(mqtt_host, &host_addr)) {
-    printf("[dns] failed to resolve host\n");
-    return -2;
+  if (mqtt_connect(broker_addr, brokers[broker].port, global_state) != 0) connection_failed();
+}
+
+// connection_failed drops the client and waits a while before trying again, with the next broker if there's more
+// than one. The wait doubles with every failure in a row, and is picked at random from its upper half, so boards that
+// lost the broker at the same time don't all come back at once.
+void IOT::connection_failed() {
+  mqtt_disconnect_and_free(global_state);
+  stale_brokers |= 1 << broker; // look it up again next time
+
+  uint32_t backoff = MQTT_RECONNECT_MIN_MS << std::min<uint8_t>(conn_failures, 16);
+  if (backoff > MQTT_RECONNECT_MAX_MS) backoff = MQTT_RECONNECT_MAX_MS;
+  backoff = backoff / 2 + random_bits() % (backoff / 2 + 1);
+  if (conn_failures < UINT8_MAX) conn_failures++;
+  broker = (broker + 1) % BROKER_COUNT;
+
+  LOG_WARN("[mqtt] connection failed (%u in a row), trying %s in %lu ms\n", conn_failures, brokers[broker].host, backoff);
+  retry_at = to_ms_since_boot(get_absolute_time()) + backoff;
+  set_conn_state(CONN_BACKOFF);
+}
+
+void IOT::set_conn_state(CONN_STATE s) {
+  conn_state = s;
+  conn_since = to_ms_since_boot(get_absolute_time());
+}
+
+// random_bits returns 32 bits from the ring oscillator, for the reconnect jitter
+uint32_t IOT::random_bits() {
+  uint32_t r = 0;
+  for (uint8_t i = 0; i < 32; i++) r = (r << 1) | (rosc_hw->randombit & 1);
+  return r;
+}
+
+// step_connection moves the connection along without ever waiting: lookup, connect, then watch for a lost link or
+// connection and start over.
+void IOT::step_connection() {
+  if (conn_state == CONN_IDLE) return;
+  uint32_t ts = to_ms_since_boot(get_absolute_time());
+  bool event = conn_event; // from on_connection
+  conn_event = false;
+
+  cyw43_arch_lwip_begin();
+  int link = cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA);
+  bool leased = net_static() || dhcp_supplied_address(&cyw43_state.netif[CYW43_ITF_STA]);
+  cyw43_arch_lwip_end();
+  if (link >= CYW43_LINK_NOIP) ledcontrol::boot::mark(ledcontrol::boot::WIFI_JOIN);
+  if (link == CYW43_LINK_UP) ledcontrol::boot::mark(ledcontrol::boot::DHCP);
+  if (link != CYW43_LINK_UP && conn_state != CONN_LINK_DOWN) {
+    LOG_WARN("[wifi] link lost: %d\n", link);
+    mqtt_disconnect_and_free(global_state);
+    set_conn_state(CONN_LINK_DOWN);
+    // the timeouts below count from losing the link, not from the join that brought it up, which may be hours ago.
+    // And it wasn't a fast join that failed: the cached access point did answer.
+    join_at = ts;
+    fast_join = false;
   }
-  printf("[dns] resolved addr to %s.\n", ip4addr_ntoa(&host_addr));
 
-  int res = mqtt_connect(host_addr, mqtt_port, state);
-  if (res != 0) {
-    printf("[mqtt] failed to connect: %d\n", res);
-    return -3;
+  switch (conn_state) {
+    case CONN_IDLE:
+      break;
+
+    case CONN_LINK_DOWN:
+      if (link == CYW43_LINK_NOIP && !addr_applied) apply_address();
+      if (link == CYW43_LINK_UP) {
+        LOG_INFO("[wifi] connected\n");
+        skip_fast_join = false;
+        start_lookup();
+      } else if (fast_join && link < CYW43_LINK_NOIP && (link < 0 || ts - join_at > WIFI_FAST_JOIN_TIMEOUT_MS)) {
+        LOG_INFO("[wifi] cached access point didn't answer (link status: %d), scanning\n", link);
+        skip_fast_join = true; // until we're connected again
+        join();
+      } else if (link < 0 || link == CYW43_LINK_DOWN ? ts - join_at >= MQTT_RECONNECT_MIN_MS : ts - join_at > WIFI_JOIN_TIMEOUT_MS) {
+        // failed, dropped, or taking too long: the driver doesn't try again by itself
+        LOG_INFO("[wifi] rejoining (link status: %d)\n", link);
+        join();
+      }
+      break;
+
+    case CONN_DNS:
+      if (dns_result > 0) {
+        ledcontrol::boot::mark(ledcontrol::boot::DNS);
+        start_connect();
+      }
+      else if (dns_result < 0 || ts - conn_since > MQTT_CONNECT_TIMEOUT_MS) connection_failed();
+      break;
+
+    case CONN_CONNECTING:
+#ifdef MQTT_TLS
+      tls_heap_max = std::max(tls_heap_max, heap_in_use()); // sampled: allocations freed within one poll aren't seen
+#endif
+      if (event && conn_status == MQTT_CONNECT_ACCEPTED) {
+        set_conn_state(CONN_CONNECTED);
+        conn_failures = 0;
+        stale_brokers &= ~(1 << broker);
+        net_cache_checked = false;
+#ifdef MQTT_TLS
+        tls_connected();
+#endif
+        ledcontrol::boot::mark(ledcontrol::boot::MQTT);
+      } else if (event || ts - conn_since > MQTT_CONNECT_TIMEOUT_MS) {
+        LOG_WARN("[mqtt] connect failed: %d\n", event ? conn_status : -1);
+        connection_failed();
+      }
+      break;
+
+    case CONN_CONNECTED:
+      if (!net_cache_checked && leased) {
+        net_cache_checked = true;
+        update_net_cache();
+      }
+      if (event && conn_status != MQTT_CONNECT_ACCEPTED) { // keepalive timeout, or the broker closed it
+        LOG_WARN("[mqtt] disconnected: %d\n", conn_status);
+        connection_failed();
+      }
+      break;
+
+    case CONN_BACKOFF:
+      if ((int32_t)(ts - retry_at) >= 0) start_lookup();
+      break;
   }
+}
 
-  return 0;
+bool IOT::is_connected() {
+  return conn_state == CONN_CONNECTED;
 }
 
 const char* IOT::get_client_id() {
@@ -192,28 +482,11 @@ void IOT::get_topic_name(char *buf, size_t buf_len, const char *prepend_str, con
   strncpy(&buf[l], append_str, buf_len - l);
 }
 
-int IOT::mqtt_connect(ip_addr_t host_addr, uint16_t host_port, mqtt_wrapper_t *state) {
-  struct mqtt_connect_client_info_t ci;
-  memset(&ci, 0, sizeof(ci));
-
-  ci.client_id = get_client_id();
-#ifdef MQTT_CLIENT_USER
-  ci.client_user = MQTT_CLIENT_USER;
-#else
-  ci.client_user = NULL;
-#endif
-#ifdef MQTT_CLIENT_PASS
-  ci.client_pass = MQTT_CLIENT_PASS;
-#else
-  ci.client_pass = NULL;
-#endif
-  ci.keep_alive = 10; // seconds. beware: mosquitto has an issue that rejects clients with 0 keep_alive
-  ci.will_topic = NULL;
-  ci.will_msg = NULL;
-  ci.will_retain = 0;
-
 #ifdef MQTT_TLS
-  struct altcp_tls_config *tls_config;
+// create_tls_config parses the certificates once: every connection shares the config
+int IOT::create_tls_config() {
+  if (tls_config != NULL) return 0;
+  cyw43_arch_lwip_begin();
 
 #ifdef MQTT_TLS_INSECURE
   printf("[mqtt] Setting up TLS insecure mode...\n");
@@ -232,21 +505,84 @@ int IOT::mqtt_connect(ip_addr_t host_addr, uint16_t host_port, mqtt_wrapper_t *s
 #else
   #error "MQTT_TLS set but no TLS config. Please edit config_iot.h"
 #endif // MQTT_TLS_INSECURE
+  cyw43_arch_lwip_end();
 
   if (tls_config == NULL) {
       // check error code shown with `strerror`, eg. `strerror -8576`
       printf("\n[mqtt] Failed to initialize TLS config\n");
       return -1;
   }
+  ledcontrol::boot::mark(ledcontrol::boot::TLS);
+  return 0;
+}
 
-//  mbedtls_ssl_set_hostname(altcp_tls_context((struct altcp_pcb *)conn), MQTT_SERVER_HOST);
+// tls_connected records how long the handshake took (with the MQTT connect on top, one round trip), and keeps the
+// session so the next connection to this broker can resume it instead of doing the key exchange again
+void IOT::tls_connected() {
+  uint32_t ms = to_ms_since_boot(get_absolute_time()) - conn_since;
+  uint32_t heap = heap_in_use();
+  if (heap > tls_heap_max) tls_heap_max = heap;
+  tls_stats.handshakes++;
+  if (tls_stats.resume_offered) tls_stats.resumes_offered++;
+  tls_stats.last_ms = ms;
+  if (ms > tls_stats.max_ms) tls_stats.max_ms = ms;
+  tls_stats.heap_used = heap - tls_heap_before;
+  tls_stats.heap_peak = tls_heap_max - tls_heap_before;
+  LOG_INFO("[tls] connected in %lu ms%s, heap: %lu bytes held, %lu peak\n", (unsigned long)ms,
+           tls_stats.resume_offered ? " (session offered)" : "", (unsigned long)tls_stats.heap_used,
+           (unsigned long)tls_stats.heap_peak);
+
+#ifdef MQTT_TLS_SESSION_RESUMPTION
+  cyw43_arch_lwip_begin();
+  if (tls_session != NULL) altcp_tls_free_session(tls_session);
+  tls_session = altcp_tls_alloc_session();
+  if (tls_session != NULL && altcp_tls_get_session(global_state->mqtt_client->conn, tls_session) != ERR_OK) {
+    altcp_tls_free_session(tls_session);
+    tls_session = NULL;
+  }
+  cyw43_arch_lwip_end();
+  tls_session_broker = broker;
+#endif
+}
+#endif // MQTT_TLS
 
+int IOT::mqtt_connect(ip_addr_t host_addr, uint16_t host_port, mqtt_wrapper_t *state) {
+  struct mqtt_connect_client_info_t ci;
+  memset(&ci, 0, sizeof(ci));
+
+  ci.client_id = get_client_id();
+#ifdef MQTT_CLIENT_USER
+  ci.client_user = MQTT_CLIENT_USER;
+#else
+  ci.client_user = NULL;
+#endif
+#ifdef MQTT_CLIENT_PASS
+  ci.client_pass = MQTT_CLIENT_PASS;
+#else
+  ci.client_pass = NULL;
+#endif
+  ci.keep_alive = 10; // seconds. beware: mosquitto has an issue that rejects clients with 0 keep_alive
+  ci.will_topic = NULL;
+  ci.will_msg = NULL;
+  ci.will_retain = 0;
+
+#ifdef MQTT_TLS
+  if (create_tls_config() != 0) return -1;
   ci.tls_config = tls_config;
 #endif // MQTT_TLS
 
+#ifdef MQTT_TLS
+  tls_heap_before = tls_heap_max = heap_in_use();
+#endif
   cyw43_arch_lwip_begin();
-  err_t err = mqtt_client_connect(state->mqtt_client, &host_addr, host_port, _iot_mqtt_connection_cb, state, &ci);
+  err_t err = mqtt_client_connect(state->mqtt_client, &host_addr, host_port, _iot_mqtt_connection_cb,
+                                  (void *)(uintptr_t)client_gen, &ci);
   // memp_malloc: out of memory in pool TCP_PCB
+#if defined(MQTT_TLS) && defined(MQTT_TLS_SESSION_RESUMPTION)
+  // the handshake only starts once TCP is connected, so there's still time to offer the last session
+  tls_stats.resume_offered = err == ERR_OK && tls_session != NULL && tls_session_broker == broker &&
+                             altcp_tls_set_session(state->mqtt_client->conn, tls_session) == ERR_OK;
+#endif
   cyw43_arch_lwip_end();
   if (err != ERR_OK) {
     printf("[mqtt] mqtt_client_connect returned error: %d\n", err);
@@ -257,20 +593,101 @@ int IOT::mqtt_connect(ip_addr_t host_addr, uint16_t host_port, mqtt_wrapper_t *s
   return 0;
 }
 
-int IOT::publish_state(const char *buffer) {
-  u8_t qos = 2; // exactly once
-  u8_t retain = 1;
+// init_subscription adds a subscription, and indexes it by the hash of its topic after the board's prefix
+void IOT::init_subscription(SUBSCRIPTION i, const char *topic, u8_t qos, void (*cb)(const char *data, size_t len)) {
+  subscriptions[i] = {.topic = topic, .qos = qos, .cb = cb};
+  uint8_t slot = fnv1a(topic + topic_prefix_len) & (SUB_INDEX_SIZE - 1);
+  while (sub_index[slot] != SUB_NONE) slot = (slot + 1) & (SUB_INDEX_SIZE - 1);
+  sub_index[slot] = i;
+}
+
+// find_subscription returns the subscription of a topic: the board's prefix is checked once, and the rest is looked up
+// by hash, so it costs the same however many topics there are
+IOT::SUBSCRIPTION IOT::find_subscription(const char *topic) {
+  if (strncmp(topic, state_topic, topic_prefix_len) != 0) return SUB_NONE;
+  const char *rest = topic + topic_prefix_len;
+  for (uint8_t slot = fnv1a(rest) & (SUB_INDEX_SIZE - 1); sub_index[slot] != SUB_NONE; slot = (slot + 1) & (SUB_INDEX_SIZE - 1)) {
+    SUBSCRIPTION i = sub_index[slot];
+    if (strcmp(rest, subscriptions[i].topic + topic_prefix_len) == 0) return i;
+  }
+  return SUB_NONE;
+}
+
+void IOT::init_outbox(OUTBOX o, const char *topic, u8_t qos, u8_t retain, char *buf, uint16_t cap) {
+  outbox[o] = {.topic = topic, .qos = qos, .retain = retain, .pending = false, .in_flight = false, .retries = 0,
+               .retry_at = 0, .buf = buf, .cap = cap, .len = 0};
+}
+
+// publish queues a message for loop() to send, replacing the one in the topic's slot if that wasn't sent yet
+int IOT::publish(OUTBOX o, const char *buffer) {
+  auto &out = outbox[o];
+  size_t len = strlen(buffer);
+  publish_stats.queued++;
+  if (len >= out.cap) {
+    publish_stats.dropped++;
+    LOG_WARN("[mqtt] message to %s too long (%u bytes), dropped\n", out.topic, len);
+    return -1;
+  }
+
+  if (out.pending) publish_stats.coalesced++;
+  memcpy(out.buf, buffer, len + 1);
+  out.len = len;
+  out.pending = true;
+  return 0;
+}
+
+// send hands the slot's message to lwIP. _mqtt_pub_request_cb tells how it went.
+int IOT::send(outbox_t *out) {
   cyw43_arch_lwip_begin();
-  err_t err = mqtt_publish(global_state->mqtt_client, state_topic, buffer, strlen(buffer), qos, retain, _iot_mqtt_pub_request_cb, global_state);
+  out->acked = false; // an ack not taken yet is for an earlier message
+  err_t err = mqtt_publish(global_state->mqtt_client, out->topic, out->buf, out->len, out->qos, out->retain, _iot_mqtt_pub_request_cb, out);
   cyw43_arch_lwip_end();
 
-  if (err != ERR_OK) printf("[mqtt] publish_state: mqtt_publish to %s %s: %d\n", state_topic, err == ERR_OK ? "successful" : "failed", err);
-  return err == ERR_OK ? 0 : -1;
+  if (err != ERR_OK) {
+    publish_failed(out, err);
+    return -1;
+  }
+
+  out->pending = false;
+  out->in_flight = true;
+  in_flight++;
+  return 0;
 }
 
-int IOT::publish_config(const char *effects, const bool is_save) {
-  const char *topic = is_save ? save_config_topic : config_topic;
+// publish_failed schedules a retry of the slot's message, backing off while it keeps failing. If a newer message
+// was queued in the meantime, that's what gets sent.
+void IOT::publish_failed(outbox_t *out, err_t err) {
+  uint32_t backoff = MQTT_PUBLISH_RETRY_MIN_MS << std::min<uint8_t>(out->retries, 16);
+  if (backoff > MQTT_PUBLISH_RETRY_MAX_MS) backoff = MQTT_PUBLISH_RETRY_MAX_MS;
+  if (out->retries < UINT8_MAX) out->retries++;
+  out->retry_at = to_ms_since_boot(get_absolute_time()) + backoff;
+  out->pending = true;
+  publish_stats.failed++;
+  LOG_WARN("[mqtt] publish to %s failed: %d, retrying in %lu ms\n", out->topic, err, backoff);
+}
+
+void IOT::loop() {
+  take_control();
+  take_messages();
 
+  step_connection();
+  if (!is_connected()) return;
+
+  uint32_t ts = to_ms_since_boot(get_absolute_time());
+  for (auto &out : outbox) {
+    if (in_flight >= MQTT_PUBLISH_MAX_IN_FLIGHT) break;
+    // one message per topic at a time, so they can't arrive out of order
+    if (!out.pending || out.in_flight) continue;
+    if (out.retries > 0 && (int32_t)(ts - out.retry_at) < 0) continue; // backing off
+    send(&out);
+  }
+}
+
+int IOT::publish_state(const char *buffer) {
+  return publish(OUT_STATE, buffer);
+}
+
+int IOT::publish_config(const char *effects, const bool is_save) {
   char buffer[2048] = {0};
   if (is_save) {
     snprintf(buffer, sizeof(buffer), "{\"board\": \"%s\", \"fw\":\"ledcontrol\", \"unique_id\":\"%s_save\", \"name\":\"%s\", "
@@ -293,78 +710,186 @@ int IOT::publish_config(const char *effects, const bool is_save) {
              state_topic, // use state topic as device name
              state_topic, command_topic, effects);
   }
-  printf("msg to publish: %s\n", buffer);
+  LOG_DEBUG("[mqtt] %sconfig: %u bytes\n", is_save ? "[save] " : "", (unsigned)strlen(buffer));
 
-  u8_t qos = 2; // exactly once
-  u8_t retain = 1;
-  cyw43_arch_lwip_begin();
-  err_t err = mqtt_publish(global_state->mqtt_client, topic, buffer, strlen(buffer), qos, retain, _iot_mqtt_pub_request_cb, global_state);
-  cyw43_arch_lwip_end();
+  return publish(is_save ? OUT_SAVE_CONFIG : OUT_CONFIG, buffer);
+}
 
-  if (err != ERR_OK) printf("[mqtt] publish_config: mqtt_publish to %s %s: %d\n", topic, err == ERR_OK ? "successful" : "failed", err);
-  return err == ERR_OK ? 0 : -1;
+// publish_diagnostics publishes a diagnostics snapshot (see profile::format_json). Not retained, and at most once by
+// default (MQTT_DIAGNOSTICS_QOS): a lost sample is replaced by the next one anyway.
+int IOT::publish_diagnostics(const char *buffer) {
+  return publish(OUT_DIAG, buffer);
 }
 
-void IOT::reset_last_topic_name() {
-  memset(global_state->last_topic_name, 0, sizeof(global_state->last_topic_name) - 1);
+// publish_diagnostics_config publishes the Home Assistant discovery config of the diagnostics sensor: the average
+// render time as its state, and every stage as attributes.
+int IOT::publish_diagnostics_config() {
+  char buffer[1024] = {0};
+  snprintf(buffer, sizeof(buffer), "{\"board\": \"%s\", \"fw\":\"ledcontrol\", \"unique_id\":\"%s_diag\", \"name\":\"%s\", "
+                                   "\"stat_t\":\"%s\", \"val_tpl\":\"{{ value_json.render.avg }}\", \"unit_of_meas\":\"us\", "
+                                   "\"json_attr_t\":\"%s\", \"ent_cat\":\"diagnostic\", \"icon\":\"mdi:timer-outline\"}",
+           PICO_BOARD,
+           get_client_id(), // use client_id as unique id
+           diag_topic, // use state topic as device name
+           diag_topic, diag_topic);
+  LOG_DEBUG("[mqtt] [diag] config: %u bytes\n", (unsigned)strlen(buffer));
+
+  return publish(OUT_DIAG_CONFIG, buffer);
 }
 
 void IOT::_mqtt_connection_cb(mqtt_client_t *client, void *arg, mqtt_connection_status_t status) {
-  if (status != MQTT_CONNECT_ACCEPTED) {
-    printf("[mqtt] connection failed (callback): %d\n", status);
-    return;
-  }
-  printf("[mqtt] connected (callback)\n");
+  control.conn_gen = (uint32_t)(uintptr_t)arg;
+  control.conn_status = status;
+  control.conn_done = true;
+  frame_clock.wake();
+}
 
-  reset_last_topic_name();
+void IOT::on_connection(mqtt_connection_status_t status) {
+  conn_status = status;
+  conn_event = true; // for step_connection
 
-  mqtt_set_inpub_callback(client, _iot_mqtt_publish_data_cb, _iot_mqtt_incoming_data_cb, NULL);
+  requeue_in_flight();
 
-  printf("[mqtt] subscribing to %s\n", command_topic);
-  err_t err = mqtt_subscribe(client, command_topic, 2, _iot_mqtt_sub_request_cb, NULL);
-  if (err != ERR_OK) {
-    printf("[mqtt] mqtt_subscribe %s returned error: %d\n", command_topic, err);
+  if (conn_status != MQTT_CONNECT_ACCEPTED) {
+    LOG_WARN("[mqtt] connection failed (callback): %d\n", conn_status);
+    return;
   }
+  LOG_INFO("[mqtt] connected (callback)\n");
 
-  printf("[mqtt] subscribing to %s\n", save_command_topic);
-  err = mqtt_subscribe(client, save_command_topic, 2, _iot_mqtt_sub_request_cb, NULL);
-  if (err != ERR_OK) {
-    printf("[mqtt] mqtt_subscribe %s returned error: %d\n", save_command_topic, err);
+  mqtt_client_t *client = global_state->mqtt_client;
+  cyw43_arch_lwip_begin();
+  mqtt_set_inpub_callback(client, _iot_mqtt_publish_data_cb, _iot_mqtt_incoming_data_cb, NULL);
+
+  for (auto &sub : subscriptions) {
+    LOG_INFO("[mqtt] subscribing to %s\n", sub.topic);
+    err_t err = mqtt_subscribe(client, sub.topic, sub.qos, _iot_mqtt_sub_request_cb, NULL);
+    if (err != ERR_OK) {
+      LOG_WARN("[mqtt] mqtt_subscribe %s returned error: %d\n", sub.topic, err);
+    }
   }
+  cyw43_arch_lwip_end();
 
   if (_connect_cb) _connect_cb();
 }
 
 void IOT::_mqtt_pub_request_cb(void *arg, err_t err) {
-  if (err == ERR_OK) {
-//    printf("[mqtt] (cb) publish successful\n");
-  } else {
-    printf("[mqtt] (cb) publish failed: %d\n", err);
-  }
+  auto out = (outbox_t *)arg;
+  if (out == NULL) return;
+  out->ack_err = err;
+  out->acked = true;
 }
 
 void IOT::_mqtt_sub_request_cb(void *arg, err_t err) {
-  if (err == ERR_OK) {
-//    printf("[mqtt] (cb) subscribe successful\n");
-  } else {
-    printf("[mqtt] (cb) subscribe failed: %d\n", err);
+  if (err == ERR_OK) return;
+  control.sub_err = err;
+  control.sub_failed++;
+}
+
+// _mqtt_publish_data_cb matches the topic to a subscription, only once per message: its fragments just carry on
+void IOT::_mqtt_publish_data_cb(void *arg, const char *topic, u32_t tot_len) {
+  rx_sub = find_subscription(topic);
+  rx_len = 0;
+  rx_tot_len = tot_len;
+  if (rx_sub == SUB_NONE) {
+    LOG_WARN("[mqtt] message on unexpected topic %s\n", topic);
+  } else if (tot_len > sizeof(rx_buf)) {
+    LOG_WARN("[mqtt] message to %s too long (%lu bytes), dropped\n", subscriptions[rx_sub].topic, (unsigned long)tot_len);
+    dropped_messages = dropped_messages + 1;
+    rx_sub = SUB_NONE;
   }
 }
 
+// _mqtt_incoming_data_cb collects a message's fragments, and latches it in its subscription's inbox when it's complete,
+// replacing one loop() didn't take yet. It doesn't wake the main loop: waking for each message would run
+// LEDControl::loop() once per message, and a burst of commands would no longer be applied as one.
 void IOT::_mqtt_incoming_data_cb(void *arg, const u8_t *data, u16_t len, u8_t flags) {
-  char topic[256] = {0};
-  strncpy(topic, global_state->last_topic_name, sizeof(topic));
-  reset_last_topic_name();
+  if (rx_sub == SUB_NONE) return; // not ours, or dropped
+  if (rx_len + len > rx_tot_len || ((flags & MQTT_DATA_FLAG_LAST) && rx_len + len != rx_tot_len)) {
+    LOG_WARN("[mqtt] message to %s incomplete, dropped\n", subscriptions[rx_sub].topic);
+    dropped_messages = dropped_messages + 1;
+    rx_sub = SUB_NONE;
+    return;
+  }
+  if (len > 0) memcpy(&rx_buf[rx_len], data, len);
+  rx_len += len;
+  if (!(flags & MQTT_DATA_FLAG_LAST)) return;
+
+  auto &in = inbox[rx_sub];
+  if (in.ready) coalesced_messages = coalesced_messages + 1;
+  memcpy(in.buf, rx_buf, rx_len);
+  in.len = rx_len;
+  in.ready = true;
+  rx_sub = SUB_NONE;
+}
 
-  printf("[mqtt] (cb) incoming data (len:%d, flags:%x, topic:%s): %.*s\n", len, flags, topic, len, (const char*)data);
+// take_control handles the control events latched by the callbacks since the last call (see control_t)
+void IOT::take_control() {
+  bool acked[OUT_COUNT];
+  err_t ack_err[OUT_COUNT];
+  cyw43_arch_lwip_begin();
+  control_t c = control;
+  control.dns_done = false;
+  control.conn_done = false;
+  control.sub_failed = 0;
+  for (uint8_t i = 0; i < OUT_COUNT; i++) {
+    acked[i] = outbox[i].acked;
+    ack_err[i] = outbox[i].ack_err;
+    outbox[i].acked = false;
+  }
+  cyw43_arch_lwip_end();
 
-  if (strcmp(topic, command_topic) == 0 && _command_cb) _command_cb((const char*)data, (size_t)len);
-  else if (strcmp(topic, save_command_topic) == 0 && _save_command_cb) _save_command_cb((const char*)data, (size_t)len);
+  if (c.dns_done && conn_state == CONN_DNS && c.dns_broker == broker) { // otherwise we gave up on it already
+    if (c.dns_found) {
+      LOG_INFO("[dns] found! %s\n", ip4addr_ntoa(&c.dns_addr));
+      broker_addr = c.dns_addr;
+      dns_result = 1;
+    } else {
+      LOG_WARN("[dns] %s not found\n", brokers[broker].host);
+      dns_result = -1;
+    }
+  }
+
+  // not one we gave up on
+  if (c.conn_done && global_state != NULL && global_state->mqtt_client != NULL && c.conn_gen == client_gen) {
+    on_connection(c.conn_status);
+  }
+
+  for (uint8_t i = 0; i < OUT_COUNT; i++) {
+    auto &out = outbox[i];
+    if (!acked[i] || !out.in_flight) continue; // sent before a reconnect, and sent again since
+
+    out.in_flight = false;
+    in_flight--;
+    if (ack_err[i] == ERR_OK) {
+      out.retries = 0;
+      publish_stats.sent++;
+    } else {
+      publish_failed(&out, ack_err[i]);
+    }
+  }
+
+  if (c.sub_failed) LOG_WARN("[mqtt] (cb) %d subscriptions failed: %d\n", c.sub_failed, c.sub_err);
 }
 
-void IOT::_mqtt_publish_data_cb(void *arg, const char *topic, u32_t tot_len) {
-  printf("[mqtt] (cb) publish data on topic: %s (length: %d)\n", topic, tot_len);
-  strncpy(global_state->last_topic_name, topic, sizeof(global_state->last_topic_name) - 1);
+// take_messages hands the latest message of each subscription, if there's a new one, to its callback
+void IOT::take_messages() {
+  for (uint8_t i = 0; i < SUB_COUNT; i++) {
+    auto &sub = subscriptions[i];
+    uint16_t len = 0;
+    cyw43_arch_lwip_begin();
+    bool ready = inbox[i].ready;
+    if (ready) {
+      len = inbox[i].len;
+      memcpy(msg_buf, inbox[i].buf, len);
+      inbox[i].ready = false;
+    }
+    cyw43_arch_lwip_end();
+    if (!ready) continue;
+
+    PROFILE_STAGE(MQTT_CB);
+    LOG_INFO("[mqtt] (cb) incoming data (len:%d, topic:%s): %s\n", len, sub.topic, ledcontrol::logging::span(msg_buf, len));
+    if (sub.cb) sub.cb(msg_buf, len);
+  }
 }
 
 IOT iot;
@@ -17,35 +17,210 @@ class IOT {
   private:
     typedef struct {
         mqtt_client_t *mqtt_client;
-        char last_topic_name[256];
     } mqtt_wrapper_t;
 
+    // Incoming messages are matched to a subscription once, when they start (see find_subscription), and latched in
+    // its inbox_t when their last fragment is in
+    enum SUBSCRIPTION : uint8_t {
+        SUB_COMMAND,
+        SUB_SAVE_COMMAND,
+
+        SUB_COUNT,
+        SUB_NONE = SUB_COUNT, // not one of ours, or too long
+    };
+
+    typedef struct {
+        const char *topic; // starts with the board's topic prefix (state_topic), like all of ours
+        u8_t qos;
+        void (*cb)(const char *data, size_t len);
+    } subscription_t;
+
+    static const uint8_t SUB_INDEX_SIZE = 8; // power of two, at least twice SUB_COUNT
+    static_assert(SUB_INDEX_SIZE >= 2 * SUB_COUNT && (SUB_INDEX_SIZE & (SUB_INDEX_SIZE - 1)) == 0, "SUB_INDEX_SIZE");
+
+    // Outgoing messages wait in one slot per topic (see publish and loop): a newer message replaces one that wasn't
+    // sent yet, so the broker always ends up with the latest.
+    enum OUTBOX : uint8_t {
+        // in send order
+        OUT_CONFIG,
+        OUT_SAVE_CONFIG,
+        OUT_DIAG_CONFIG,
+        OUT_STATE,
+        OUT_DIAG,
+
+        OUT_COUNT
+    };
+
+    typedef struct {
+        const char *topic;
+        u8_t qos;
+        u8_t retain;
+        bool pending; // buf holds a message that wasn't sent yet
+        bool in_flight; // a message was handed to lwIP, waiting for its callback
+        uint8_t retries; // failed attempts in a row
+        bool acked; // _mqtt_pub_request_cb was called with ack_err, see control_t
+        err_t ack_err;
+        uint32_t retry_at; // ms, don't try again before this, if retries > 0
+        char *buf;
+        uint16_t cap;
+        uint16_t len;
+    } outbox_t;
+
+    // The connection is a state machine stepped by loop() (see step_connection)
+    enum CONN_STATE : uint8_t {
+        CONN_IDLE, // connect() wasn't called yet
+        CONN_LINK_DOWN, // waiting for WiFi, rejoining if needed
+        CONN_DNS, // looking up the broker
+        CONN_CONNECTING, // waiting for the broker to accept
+        CONN_CONNECTED,
+        CONN_BACKOFF, // waiting to try again
+    };
+
+    // What the last successful connection used, kept in flash so the next boot can join and connect without
+    // scanning, waiting for DHCP or looking up the broker (see join, apply_address and start_lookup)
+    static const uint8_t CACHED_BROKERS = 4;
+    typedef struct {
+        char magic[8];
+        uint32_t size; // of this struct, a different one is ignored
+        uint32_t ssid_hash; // a different network is ignored
+        uint8_t bssid[6];
+        uint8_t channel; // 0: nothing cached, scan
+        uint32_t ip, netmask, gw, dns; // the DHCP lease, 0 if none
+        uint32_t broker_addr[CACHED_BROKERS]; // first MQTT_SERVERS, 0 if not looked up
+    } net_cache_t;
+
+    // lwIP callbacks only record what happened, loop() handles it. With pico_cyw43_arch_lwip_threadsafe_background
+    // they run from an interrupt, in the middle of whatever the main loop was doing.
+    //
+    // Nothing they report can be lost to a burst: the callbacks latch it in control_t (and pub acks in their
+    // outbox_t, incoming messages in their subscription's inbox_t), written under the lwIP lock and taken under it by
+    // take_control and take_messages. A later event of the same kind replaces one not taken yet: only the latest
+    // matters, for commands too.
+    typedef struct {
+        bool dns_done;
+        bool dns_found;
+        uint8_t dns_broker; // index in MQTT_SERVERS, BROKER_COUNT if none matched
+        ip_addr_t dns_addr;
+        bool conn_done;
+        uint32_t conn_gen; // which client, see start_connect
+        mqtt_connection_status_t conn_status;
+        err_t sub_err; // of the last failed subscription
+        uint8_t sub_failed;
+    } control_t;
+
+    // The latest complete message of a subscription, put together from its fragments by the callbacks (see
+    // _mqtt_incoming_data_cb)
+    typedef struct {
+        bool ready; // buf holds a message take_messages didn't take yet
+        uint16_t len;
+        char buf[MQTT_RX_MAX_LEN];
+    } inbox_t;
+
+    CONN_STATE conn_state = CONN_IDLE;
+    uint32_t conn_since = 0; // ms, when we entered conn_state
+    uint32_t retry_at = 0; // ms
+    uint32_t join_at = 0; // ms, last WiFi join attempt
+    uint8_t conn_failures = 0; // in a row
+    uint8_t broker = 0; // index in MQTT_SERVERS
+    ip_addr_t broker_addr;
+    int8_t dns_result = 0; // 0: in progress, 1: found, -1: failed. Set by start_lookup, or take_control
+    bool conn_event = false; // on_connection got conn_status from take_control, not handled by step_connection yet
+    mqtt_connection_status_t conn_status;
+    uint32_t client_gen = 0; // incremented for every client, so events of one we dropped are ignored
+    control_t control = {};
+    net_cache_t net_cache;
+    bool fast_join = false; // the last join went straight to the cached access point
+    bool addr_applied = false; // apply_address ran since the last join
+    bool skip_fast_join = false; // the cached access point didn't answer, scan until the link is up
+    bool net_cache_checked = false; // update_net_cache ran since we connected
+    uint8_t stale_brokers = 0; // bit per broker whose cached address failed, looked up until it connects
+    struct altcp_tls_config *tls_config = NULL; // created once, shared by every connection
+    struct altcp_tls_session *tls_session = NULL; // of the last connection, offered to the next one
+    uint8_t tls_session_broker = 0; // that tls_session is for
+    uint32_t tls_heap_before = 0, tls_heap_max = 0; // heap in use when connecting, and the most seen since
+    const char *_ssid = NULL, *_password = NULL;
+    uint32_t _authmode = 0;
+
     mqtt_wrapper_t *global_state;
+    outbox_t outbox[OUT_COUNT];
+    uint8_t in_flight = 0;
+    char config_buf[2048], save_config_buf[512], diag_config_buf[1024], state_buf[256], diag_buf[2048];
     char state_topic[256], command_topic[256], config_topic[256];
     char save_state_topic[256], save_command_topic[256], save_config_topic[256];
+    char diag_topic[256], diag_config_topic[256];
 
     void (*_connect_cb)();
-    void (*_loop_cb)();
-    void (*_command_cb)(const char *data, size_t len);
-    void (*_save_command_cb)(const char *data, size_t len);
+    subscription_t subscriptions[SUB_COUNT];
+    SUBSCRIPTION sub_index[SUB_INDEX_SIZE]; // open addressing hash table of the topics after the prefix
+    uint16_t topic_prefix_len = 0;
+    inbox_t inbox[SUB_COUNT];
+    // callbacks only: the message being received
+    SUBSCRIPTION rx_sub = SUB_NONE;
+    char rx_buf[MQTT_RX_MAX_LEN]; // its fragments so far
+    uint16_t rx_len = 0;
+    uint32_t rx_tot_len = 0; // announced by _mqtt_publish_data_cb
+    char msg_buf[MQTT_RX_MAX_LEN]; // loop() only: the message being handed to its subscription's callback
 
-    void poll_wifi(uint32_t min_sleep_ms = 100);
-    int run_dns_lookup(const char *host, ip_addr_t *addr);
+    int join();
+    void apply_address();
+    void load_net_cache();
+    void update_net_cache();
+    int create_tls_config();
+    void tls_connected();
     int mqtt_connect(ip_addr_t host_addr, uint16_t host_port, mqtt_wrapper_t *state);
     void mqtt_disconnect_and_free(mqtt_wrapper_t *state);
-    int mqtt_fresh_state(const char *mqtt_host, uint16_t mqtt_port, mqtt_wrapper_t *state);
+    void set_conn_state(CONN_STATE s);
+    void step_connection();
+    void start_lookup();
+    void start_connect();
+    void connection_failed();
+    uint32_t random_bits();
     void get_topic_name(char *buf, size_t buf_len, const char *prepend_str, const char *append_str);
-    void reset_last_topic_name();
+    void init_subscription(SUBSCRIPTION i, const char *topic, u8_t qos, void (*cb)(const char *data, size_t len));
+    SUBSCRIPTION find_subscription(const char *topic);
+    void init_outbox(OUTBOX o, const char *topic, u8_t qos, u8_t retain, char *buf, uint16_t cap);
+    int publish(OUTBOX o, const char *buffer);
+    int send(outbox_t *out);
+    void publish_failed(outbox_t *out, err_t err);
+    void requeue_in_flight();
+    void take_control();
+    void take_messages();
+    void on_connection(mqtt_connection_status_t status);
 
   public:
     IOT();
-    int init(const char *ssid, const char *password, uint32_t authmode, void (*loop_cb)(), void (*connect_cb)(), void (*command_cb)(const char *data, size_t len), void (*save_command_cb)(const char *data, size_t len));
+    int init(const char *ssid, const char *password, uint32_t authmode, void (*connect_cb)(), void (*command_cb)(const char *data, size_t len), void (*save_command_cb)(const char *data, size_t len));
     int connect();
+    bool is_connected();
     const char* get_client_id();
     int publish_state(const char *buffer);
     int publish_config(const char *effects, const bool is_save = false);
+    int publish_diagnostics(const char *buffer);
+    int publish_diagnostics_config();
+    void loop(); // keeps the connection up and sends what's queued by the publish calls, call it once per frame
 
-    // callbacks
+    typedef struct {
+        uint32_t queued; // publish calls
+        uint32_t coalesced; // replaced before they were sent
+        uint32_t sent; // acknowledged by the broker (or handed to TCP, for QoS 0)
+        uint32_t failed; // attempts that failed, they're retried
+        uint32_t dropped; // too long for their slot
+    } publish_stats_t;
+    publish_stats_t get_publish_stats() { return publish_stats; }
+
+    typedef struct {
+        uint32_t handshakes; // successful TLS connections
+        uint32_t resumes_offered; // how many of them offered the previous session, see MQTT_TLS_SESSION_RESUMPTION
+        bool resume_offered; // the last one did
+        uint32_t last_ms, max_ms; // from connecting to the broker accepting, mostly the handshake
+        uint32_t heap_used; // bytes the last connection allocated and still holds after the handshake
+        uint32_t heap_peak; // bytes, the most it held during the handshake (sampled once per loop())
+    } tls_stats_t;
+    tls_stats_t get_tls_stats() { return tls_stats; }
+    uint32_t get_coalesced_messages() { return coalesced_messages; }
+    uint32_t get_dropped_messages() { return dropped_messages; }
+
+    // lwIP callbacks, see control_t
     void _dns_found_cb(const char *name, const ip_addr_t *ipaddr, void *callback_arg);
     void _mqtt_connection_cb(mqtt_client_t *client, void *arg, mqtt_connection_status_t status);
     void _mqtt_pub_request_cb(void *arg, err_t err);
@@ -53,6 +228,11 @@ class IOT {
     void _mqtt_incoming_data_cb(void *arg, const u8_t *data, u16_t len, u8_t flags);
     void _mqtt_publish_data_cb(void *arg, const char *topic, u32_t tot_len);
 
+  private:
+    publish_stats_t publish_stats = {};
+    tls_stats_t tls_stats = {};
+    volatile uint32_t coalesced_messages = 0; // incoming messages replaced by a newer one before loop() took them
+    volatile uint32_t dropped_messages = 0; // incoming messages that were too long or incomplete
 };
 
 extern IOT iot;
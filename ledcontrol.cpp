@@ -9,8 +9,11 @@
 #endif
 #include "hardware/flash.h"
 #include "hardware/sync.h"
+#include "pico/multicore.h"
 
 #include "util.h"
+#include "logging.h"
+#include "profile.h"
 #include "config.h"
 
 using namespace ledcontrol;
@@ -27,63 +30,42 @@ LEDControl::LEDControl():
     transition_duration(0),
     transition_start_brightness(0),
     transition_target_brightness(1.0f),
-    led_strip(NUM_LEDS, pio0, 0, LED_DATA_PIN, plasma::WS2812::DEFAULT_SERIAL_FREQ, LED_RGBW, LED_ORDER),
+    renderer(NUM_LEDS, pio0, LED_DATA_PIN, LED_PARALLEL_STRIPS),
     button_b(pimoroni::Button(BUTTON_B_PIN, pimoroni::Polarity::ACTIVE_LOW, 0)),
     button_c(pimoroni::Button(BUTTON_C_PIN, pimoroni::Polarity::ACTIVE_LOW, 0)),
-    cycle_once(false),
     _on_state_change_cb(NULL)
 {
   state.on = false; // so that we can turn it on with a transition
 }
 
-void LEDControl::set_brightness(float_t brightness) {
-  eff_brightness = brightness;
-  cycle_loop(0, 0, 0, true);
+// render_snapshot returns everything the renderer needs to know about the current state
+Renderer::snapshot_t LEDControl::render_snapshot() {
+  Renderer::snapshot_t s = {
+    .hue = state.hue,
+    .angle = state.angle,
+    .speed = state.speed,
+    .effect = state.effect,
+    .cycle = cycle,
+    .blackout = blackout,
+    .start_time = start_time,
+    .stop_time = stop_time,
+    .brightness = get_effective_on_state(state) ? state.brightness : 0,
+    .transition_start_time = transition_start_time,
+    .transition_duration = transition_duration,
+    .transition_start_brightness = transition_start_brightness,
+    .transition_target_brightness = transition_target_brightness,
+    .input_time = encoder_last_activity,
+  };
+  return s;
 }
 
-// call led_strip.update() after this?
-void LEDControl::cycle_loop(float hue, float t, float angle, bool refresh) {
-  static float old_hue = 0.0f, old_t = 0.0f, old_angle = 0.0f;
-  if (refresh) {
-    hue = old_hue;
-    t = old_t;
-    angle = old_angle;
-  } else {
-    old_hue = hue;
-    old_t = t;
-    old_angle = angle;
-  }
-
-  auto hue_deg = hue * 360.0f;
-  auto angle_deg = angle * 360.0f;
-
-  t /= 200.0f;
-
-  for(auto i = 0u; i < led_strip.num_leds; ++i) {
-    float percent_along = (float)i / (float)led_strip.num_leds;
-    float offset = sinf((percent_along + 0.5f + t) * M_PI) * angle_deg;
-    float h = wrap((hue_deg + offset) / 360.0f, 0.0f, 1.0f);
-    uint8_t white;
-
-    switch(state.effect) {
-      case EFFECT_MODE::HUE_CYCLE:
-      default:
-        led_strip.set_hsv(i, h, 1.0f, eff_brightness);
-        break;
-      case EFFECT_MODE::WHITE_CHASE:
-        white = uint8_t((1.0f - h) * eff_brightness * 255.0f);
-        if (LED_RGBW) {
-          led_strip.set_rgb(i, 0, 0, 0, white);
-        } else {
-          led_strip.set_rgb(i, white, white, white);
-        }
-        break;
-    }
-  }
+// send_render_state sends the current state to the renderer. If its queue is full, loop() retries.
+void LEDControl::send_render_state() {
+  render_state_dirty = !renderer.send(render_snapshot());
 }
 
 const char* LEDControl::effect_to_str(EFFECT_MODE effect) {
-  return effect < EFFECT_COUNT ? effect_str[effect] : "";
+  return effect < EFFECT_COUNT ? effects::All::names[effect] : "";
 }
 
 const char* LEDControl::speed_to_str(float_t speed) {
@@ -111,17 +93,11 @@ float_t LEDControl::str_to_speed(const char *str) {
 }
 
 int LEDControl::parse_effect_str(const char *str, EFFECT_MODE *effect, float_t *speed) {
-  bool found = false;
-  for(uint8_t i = 0; i < EFFECT_COUNT; i++) {
-    if (strstarts(str, effect_str[i])) {
-      *effect = (EFFECT_MODE)i;
-      found = true;
-      break;
-    }
-  }
-  if (!found) {
+  int i = effects::All::find(str);
+  if (i < 0) {
     return -1;
   }
+  *effect = (EFFECT_MODE)i;
 
   size_t remaining_pos = strlen(effect_to_str(*effect));
   if (str[remaining_pos] == ':') {
@@ -133,9 +109,10 @@ int LEDControl::parse_effect_str(const char *str, EFFECT_MODE *effect, float_t *
 
 size_t LEDControl::get_effect_list(LEDControl::EFFECT_MODE *effects, size_t num_effects) {
   size_t limit = 0;
-  effects[limit++] = EFFECT_MODE::HUE_CYCLE;
-  if (limit >= num_effects) return limit;
-  effects[limit++] = EFFECT_MODE::WHITE_CHASE;
+  for(uint8_t i = 0; i < EFFECT_COUNT; i++) {
+    effects[limit++] = (EFFECT_MODE)i;
+    if (limit >= num_effects) return limit;
+  }
   return limit;
 }
 
@@ -164,11 +141,19 @@ void LEDControl::set_cycle(bool v) {
   }
 
   cycle = v;
+  send_render_state();
   if (state.stopped) return; // don't update LEDs if stopped on command
 
 #ifdef LED_PAUSED_PIN
   gpio_put(LED_PAUSED_PIN, !cycle);
 #endif
+#ifdef RASPBERRYPI_PICO_W
+  if (radio_up) cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, !cycle);
+#endif
+}
+
+void LEDControl::set_radio_up() {
+  radio_up = true;
 #ifdef RASPBERRYPI_PICO_W
   cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, !cycle);
 #endif
@@ -233,21 +218,18 @@ void LEDControl::set_encoder_state() {
 void LEDControl::init(Encoder *e) {
   enc = e;
   enc->init(ROT_LEDR, ROT_LEDG, ROT_LEDB, ROT_A, ROT_B, ROT_SW, true);
+  // buttons are polled, the IRQ (through the encoder's GPIO callback) is only there to wake the main loop
+  gpio_set_irq_enabled(BUTTON_B_PIN, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, true);
+  gpio_set_irq_enabled(BUTTON_C_PIN, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, true);
 
 #ifdef LED_PAUSED_PIN
   gpio_init(LED_PAUSED_PIN);
   gpio_set_dir(LED_PAUSED_PIN, GPIO_OUT);
   gpio_put(LED_PAUSED_PIN, false);
 #endif
-#ifdef RASPBERRYPI_PICO_W
-  cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, 0);
-#endif
-
-  // since we call led_strip.update every time we need an update, we don't need to call led_strip.start to start the update timer
-  // led_strip.start(UPDATES);
 
   if (load_state_from_flash() != 0) {
-    printf("failed to load state from flash, using defaults\n");
+    LOG_WARN("failed to load state from flash, using defaults\n");
     enable_state(DEFAULT_STATE);
   }
 
@@ -255,24 +237,9 @@ void LEDControl::init(Encoder *e) {
 
   start_time = millis();
   set_cycle(true);
-}
-
-float_t LEDControl::get_effective_brightness() {
-  if (transition_start_time == 0) {
-    transition_start_brightness = get_effective_on_state(state) ? state.brightness : 0;
-    return transition_start_brightness;
-  }
-
-  auto ts = millis();
-  if (ts < transition_start_time || ts > transition_start_time+transition_duration) {
-    transition_start_time = 0;
-    return get_effective_brightness();
-  }
+  send_render_state();
 
-  // sinusoidal transition
-  float_t t = (float_t)(ts-transition_start_time) / (float_t)transition_duration;
-  float_t b = (1.0f-cosf(t*M_PI))/2.0f;
-  return (transition_start_brightness + b*(transition_target_brightness-transition_start_brightness));
+  renderer.start();
 }
 
 bool LEDControl::get_effective_on_state(state_t s) {
@@ -283,7 +250,7 @@ bool LEDControl::get_effective_on_state(state_t s) {
   return s.on;
 }
 
-void LEDControl::enable_state(state_t p_state) {
+void LEDControl::enable_state(state_t p_state, int32_t transition_ms) {
   // clamp in case we loaded from flash or iot
   p_state.hue = std::min(1.0f, std::max(0.0f, p_state.hue));
   p_state.angle = std::min(1.0f, std::max(0.0f, p_state.angle));
@@ -295,28 +262,26 @@ void LEDControl::enable_state(state_t p_state) {
   if (p_state.stopped) p_state.speed = 0.0f;
   if (p_state.speed == 0.0f) {
     if (state.speed != 0.0f) {
-      printf("[enable_state] enabling stopped mode\n");
+      LOG_INFO("[enable_state] enabling stopped mode\n");
       p_state.speed = state.speed; // keep it the same
       change_cycle = true;
     } else {
-      printf("[enable_state] already in stopped mode\n");
+      LOG_INFO("[enable_state] already in stopped mode\n");
     }
     p_state.stopped = true;
   } else {
-    printf("[enable_state] disabling stopped mode: new speed will be %f\n", p_state.speed);
+    LOG_INFO("[enable_state] disabling stopped mode: new speed will be %f\n", p_state.speed);
     p_state.stopped = false;
     change_cycle = true;
   }
 
-  if (p_state.hue != state.hue || p_state.angle != state.angle || p_state.effect != state.effect) cycle_once = true;
-
   bool p_on = get_effective_on_state(p_state);
 
   if (p_on != get_effective_on_state(state)) {
     // fade in-out
-    transition_start_brightness = eff_brightness;
+    transition_start_brightness = Renderer::effective_brightness(render_snapshot(), millis());
     transition_start_time = millis();
-    transition_duration = p_on ? FADE_IN_DURATION : FADE_OUT_DURATION;
+    transition_duration = transition_ms >= 0 ? transition_ms : p_on ? FADE_IN_DURATION : FADE_OUT_DURATION;
     transition_target_brightness = p_on ? state.brightness : MIN_BRIGHTNESS;
   }
 
@@ -326,34 +291,47 @@ void LEDControl::enable_state(state_t p_state) {
 
   log_state("enable_state", state);
 
-  if (transition_loop(true)) led_strip.update();
+  send_render_state();
 
   set_encoder_state();
   global_last_activity = millis();
   if (_on_state_change_cb) _on_state_change_cb(state);
 }
 
-bool LEDControl::transition_loop(bool force) {
-  if (!force && transition_start_time == 0) return false;
+LEDControl::state_t LEDControl::get_state() {
+  return state;
+}
 
-  // we do this to prevent flickering
-  static float_t old_eff_brightness = -1.0f;
-  float_t tmp = get_effective_brightness();
-  if (old_eff_brightness == -1.0f || old_eff_brightness != tmp) {
-    set_brightness(tmp);
-    old_eff_brightness = tmp;
-    return true; // changed, need to call led_strip.update()
+void LEDControl::queue_state(state_t p_state, int32_t transition_ms) {
+  command_stats.queued++;
+  if (state_pending) {
+    command_stats.coalesced++;
+    if (transition_ms < 0) transition_ms = pending_transition_ms;
   }
+  pending_state = p_state;
+  pending_transition_ms = transition_ms;
+  state_pending = true;
+}
 
-  return false;
+LEDControl::state_t LEDControl::get_pending_state() {
+  return state_pending ? pending_state : state;
 }
 
-LEDControl::state_t LEDControl::get_state() {
-  return state;
+// apply_pending_state enables the state queued by queue_state, if any
+void LEDControl::apply_pending_state() {
+  if (!state_pending) return;
+  state_pending = false;
+
+  // commands don't set these, and they may have changed since the state was queued
+  pending_state.mode = state.mode;
+  pending_state.absent = state.absent;
+
+  command_stats.applied++;
+  enable_state(pending_state, pending_transition_ms);
 }
 
 void LEDControl::log_state(const char *prefix, state_t s) {
-  printf("[%s] hue: %f, angle: %f, speed: %f, brightness: %f, mode:%d, effect:%d%s%s%s\n",
+  LOG_INFO("[%s] hue: %f, angle: %f, speed: %f, brightness: %f, mode:%d, effect:%d%s%s%s\n",
          prefix, s.hue, s.angle, s.speed, s.brightness, s.mode, s.effect, s.stopped? " (stopped)":"", s.on? "":" (off)", s.absent?" (absent)":"");
 }
 
@@ -367,11 +345,11 @@ int LEDControl::load_state_from_flash() {
 
   auto *flash_state = (flash_state_t *)buffer;
   if (memcmp(flash_state->magic, flash_save_magic, strlen(flash_save_magic)) != 0) {
-    printf("load_state_from_flash: invalid state magic\n");
+    LOG_WARN("load_state_from_flash: invalid state magic\n");
     return -1;
   }
   if (flash_state->state_size != sizeof(state_t)) {
-    printf("load_state_from_flash: invalid state_t size\n");
+    LOG_WARN("load_state_from_flash: invalid state_t size\n");
     return -2;
   }
   enable_state(flash_state->state);
@@ -383,23 +361,23 @@ void LEDControl::save_state_to_flash() {
   static uint32_t last_save = 0;
   uint32_t ts = to_ms_since_boot(get_absolute_time());
   if (ts - last_save < 5000) {
-    printf("save_state_to_flash: too early\n");
+    LOG_WARN("save_state_to_flash: too early\n");
     last_save = ts; // require cooldown to prevent accidental spamming
     return;
   }
 
-  set_brightness(0);
-  led_strip.update();
+  blackout = true;
+  send_render_state();
   sleep_ms(1500);
   _save_state_to_flash();
 
-  set_brightness(get_effective_brightness());
-  led_strip.update();
+  blackout = false;
+  send_render_state();
   global_last_activity = millis();
 }
 
 int LEDControl::_save_state_to_flash() {
-  printf("_save_state_to_flash: start\n");
+  LOG_INFO("_save_state_to_flash: start\n");
 
   // prepare the buffer
   uint8_t buffer[256];
@@ -416,23 +394,27 @@ int LEDControl::_save_state_to_flash() {
 
 //  print_buf(buffer, sizeof(buffer));
 
+  // core1 renders from flash (XIP), park it in RAM for the duration
+  multicore_lockout_start_blocking();
   uint32_t ints = save_and_disable_interrupts();
   flash_range_erase(FLASH_TARGET_OFFSET, sizeof(buffer));
   flash_range_program(FLASH_TARGET_OFFSET, buffer, sizeof(buffer));
   restore_interrupts(ints);
+  multicore_lockout_end_blocking();
 
-  printf("_save_state_to_flash: success\n");
+  LOG_INFO("_save_state_to_flash: success\n");
 
 //  LEDControl::load_state_from_flash();
   return 0;
 }
 
-uint32_t LEDControl::loop() {
-  uint32_t t = millis() - start_time;
+void LEDControl::loop() {
+  apply_pending_state();
+
   if(enc->get_interrupt_flag()) {
     signed int count_raw = enc->read(); // Looks like -64 to +64, but we assume -10 to +10
     float_t count = std::min(10.0f, std::max(-10.0f, (float_t)count_raw))/50.0f; // Max increase can be 20% per update
-    printf("[encoder] count: %d (%f)\n", count_raw, count);
+    LOG_DEBUG("[encoder] count: %d (%f)\n", count_raw, count);
     enc->clear_interrupt_flag();
     enc->clear();
     encoder_last_activity = millis();
@@ -442,7 +424,7 @@ uint32_t LEDControl::loop() {
       default:
       case MENU_MODE::MENU_SELECT:
         state.mode = (ENCODER_MODE)limiting_wrap(state.mode + (count < 0.0f ? -1 : 1), 0, ENCODER_MODE::MODE_COUNT);
-        printf("[mode] new mode: %d\n", state.mode);
+        LOG_DEBUG("[mode] new mode: %d\n", state.mode);
         set_encoder_state();
         break;
       case MENU_MODE::MENU_ADJUST:
@@ -458,20 +440,18 @@ uint32_t LEDControl::loop() {
 
           case ENCODER_MODE::COLOUR:
             new_state.hue = wrap(state.hue + count, 0.0f, 1.0f);
-            printf("new hue start angle: %f\n", state.hue);
+            LOG_DEBUG("new hue start angle: %f\n", state.hue);
             break;
 
           case ENCODER_MODE::ANGLE:
             new_state.angle = std::min(1.0f, std::max(0.0f, state.angle + count));
-            printf("new hue end angle: %f\n", state.angle);
+            LOG_DEBUG("new hue end angle: %f\n", state.angle);
             break;
 
           case ENCODER_MODE::BRIGHTNESS:
             new_state.brightness = std::min(MAX_BRIGHTNESS, std::max(MIN_BRIGHTNESS, state.brightness + count));
-            printf("new brightness: %f\n", new_state.brightness);
-            set_brightness(get_effective_brightness());
+            LOG_DEBUG("new brightness: %f\n", new_state.brightness);
             enc->set_brightness(new_state.brightness);
-            led_strip.update();
             break;
 
           case ENCODER_MODE::SPEED:
@@ -482,13 +462,13 @@ uint32_t LEDControl::loop() {
             } else if (new_state.speed != 0.0f) {
               new_state.stopped = false;
             }
-            printf("new speed: %f%s\n", new_state.speed, new_state.stopped?" (stopped)":"");
+            LOG_DEBUG("new speed: %f%s\n", new_state.speed, new_state.stopped?" (stopped)":"");
             break;
 
           case ENCODER_MODE::EFFECT:
             new_state.effect = (EFFECT_MODE)limiting_wrap(state.effect + (count < 0.0 ? -1 : 1), 0, EFFECT_MODE::EFFECT_COUNT);
 
-            printf("new effect: %d\n", state.effect);
+            LOG_DEBUG("new effect: %d\n", state.effect);
             break;
         }
 
@@ -497,7 +477,11 @@ uint32_t LEDControl::loop() {
     }
   } // get_interrupt_flag
 
-  auto b_val = wait_for_long_button(button_b, 1500);
+  uint8_t b_val;
+  {
+    PROFILE_STAGE(BUTTONS);
+    b_val = wait_for_long_button(button_b, 1500);
+  }
   bool b_pressed = b_val == 1;
   bool b_held = b_val == 2;
 
@@ -509,23 +493,23 @@ uint32_t LEDControl::loop() {
   }
 
   if (b_pressed || b_held) {
-    printf("[button] B pressed:%d held:%d\n", b_pressed, b_held);
+    LOG_INFO("[button] B pressed:%d held:%d\n", b_pressed, b_held);
   }
 
   if(b_held) {
-    printf("B held\n");
+    LOG_INFO("B held\n");
     save_state_to_flash();
   }
 
   if(b_pressed) {
-    printf("B pressed! saved state or defaults\n");
+    LOG_INFO("B pressed! saved state or defaults\n");
     enable_state(DEFAULT_STATE);
     menu_mode = MENU_MODE::MENU_SELECT;
     set_cycle(true);
   }
 
   if (button_c.read()) {
-    printf("C pressed! toggling on/off to %d\n", (int)(!state.on));
+    LOG_INFO("C pressed! toggling on/off to %d\n", (int)(!state.on));
 
     menu_mode = MENU_MODE::MENU_SELECT;
     state.mode = ENCODER_MODE::OFF;
@@ -541,14 +525,14 @@ uint32_t LEDControl::loop() {
       state.mode = ENCODER_MODE::COLOUR;
     } else {
       menu_mode = (MENU_MODE)(((int) menu_mode + 1) % (int) MENU_MODE::MENU_COUNT);
-      printf("[menu] new menu selection: %d\n", menu_mode);
+      LOG_INFO("[menu] new menu selection: %d\n", menu_mode);
       if (!cycle) resume_cycle = true;
     }
     set_encoder_state();
   }
 
   if (ENCODER_INACTIVITY_TIMEOUT>0 && state.mode != ENCODER_MODE::OFF && encoder_last_activity > 0 && millis() - encoder_last_activity > ENCODER_INACTIVITY_TIMEOUT) {
-    printf("[menu] encoder inactivity, switching to off mode\n");
+    LOG_INFO("[menu] encoder inactivity, switching to off mode\n");
     encoder_last_activity = 0;
     menu_mode = MENU_MODE::MENU_SELECT;
     state.mode = ENCODER_MODE::OFF;
@@ -558,35 +542,19 @@ uint32_t LEDControl::loop() {
 
   if (resume_cycle) {
     set_cycle(true);
-    t = millis() - start_time;
     log_state("cycle", state);
   }
 
-  bool need_refresh = false;
-  if (cycle || cycle_once) {
-    cycle_loop(state.hue, (float) (t - get_paused_time()) * state.speed, state.angle);
-    cycle_once = false;
-    need_refresh = true;
-  }
-
-  need_refresh |= transition_loop(false);
-
   if (global_last_activity > 0 && GLOBAL_INACTIVITY_TIMEOUT_SECS > 0 && millis() - global_last_activity > GLOBAL_INACTIVITY_TIMEOUT_SECS * 1000 && state.on) {
-    printf("[menu] global inactivity, turning off\n");
+    LOG_INFO("[menu] global inactivity, turning off\n");
     global_last_activity = 0;
     auto p_state = state;
     p_state.on = false;
     enable_state(p_state);
   }
 
-  if (need_refresh) {
-    led_strip.update();
-  }
+  if (render_state_dirty) send_render_state();
 
   if (menu_mode == MENU_MODE::MENU_ADJUST) encoder_loop();
   else encoder_blink_off();
-
-  // Sleep time controls the rate at which the LED buffer is updated
-  // but *not* the actual framerate at which the buffer is sent to the LEDs
-  return 1000 / UPDATES;
 }
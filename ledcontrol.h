@@ -7,6 +7,8 @@
 #include "button.hpp"
 #include <drivers/plasma/ws2812.hpp>
 #include "encoder.h"
+#include "renderer.h"
+#include "effects.h"
 
 namespace ledcontrol {
 
@@ -33,11 +35,12 @@ namespace ledcontrol {
             MODE_COUNT
         };
 
+        // see effects.h to add effects
         enum EFFECT_MODE : uint8_t {
-            HUE_CYCLE = 0,
-            WHITE_CHASE,
+            HUE_CYCLE = effects::All::index_of<effects::HueCycle>(),
+            WHITE_CHASE = effects::All::index_of<effects::WhiteChase>(),
 
-            EFFECT_COUNT,
+            EFFECT_COUNT = effects::All::count,
         };
 
         static const uint8_t SPEED_COUNT = 5;
@@ -56,9 +59,20 @@ namespace ledcontrol {
         } state_t;
 
         void init(Encoder *e);
-        uint32_t loop(); // returns: required sleep value in ms
-        void enable_state(state_t p_state);
+        void loop(); // call once per frame (see FrameClock)
+        // set_radio_up tells that cyw43_arch_init is done: the Pico W's board LED is on the radio chip, so it's only
+        // driven from then on. Rendering doesn't wait for the radio.
+        void set_radio_up();
+        bool is_paused() { return !cycle; } // the board LED is lit while paused (see set_cycle)
+        // transition_ms overrides the fade duration when turning on or off, if it's not negative
+        void enable_state(state_t p_state, int32_t transition_ms = -1);
         state_t get_state();
+        // queue_state is enable_state for remote commands: the state is applied by the next loop(), and queueing again
+        // before then replaces it, so a burst of commands costs one enable_state per frame. A transition is kept
+        // unless a later command brings its own.
+        void queue_state(state_t p_state, int32_t transition_ms = -1);
+        state_t get_pending_state(); // the queued state if there is one, the current state otherwise
+        void apply_pending_state(); // enables the queued state now, rather than at the next loop()
         void log_state(const char *prefix, state_t s);
 
         // iot control helpers
@@ -75,6 +89,17 @@ namespace ledcontrol {
 
         void set_on_state_change_cb(void (*cb)(state_t new_state)) { _on_state_change_cb = cb; }
 
+        Renderer::output_stats_t get_output_stats() { return renderer.get_output_stats(); }
+        FrameClock::stats_t get_clock_stats() { return renderer.get_clock_stats(); } // render loop, on core1
+        Renderer::governor_stats_t get_governor_stats() { return renderer.get_governor_stats(); }
+
+        typedef struct {
+            uint32_t queued; // queue_state calls
+            uint32_t applied; // enable_state calls they turned into
+            uint32_t coalesced; // replaced before they were applied
+        } command_stats_t;
+        command_stats_t get_command_stats() { return command_stats; }
+
       private:
         state_t state;
         uint32_t encoder_last_blink;
@@ -87,15 +112,21 @@ namespace ledcontrol {
         float_t transition_start_brightness;
         float_t transition_target_brightness;
 
-        float_t eff_brightness = -1.0f;
+        bool blackout = false;
+        bool radio_up = false; // see set_radio_up
 
-        plasma::WS2812 led_strip;
+        Renderer renderer; // runs on core1
+        bool render_state_dirty = false; // state changed but the snapshot couldn't be queued yet
+        bool state_pending = false; // see queue_state
+        state_t pending_state;
+        int32_t pending_transition_ms = -1;
+        command_stats_t command_stats = {};
         pimoroni::Button button_b;
         pimoroni::Button button_c;
         Encoder *enc = nullptr;
 
         enum MENU_MODE menu_mode;
-        bool cycle{}, cycle_once{};
+        bool cycle{};
 
         const char flash_save_magic[8] = "LEDCTRL";
         typedef struct {
@@ -107,11 +138,9 @@ namespace ledcontrol {
         void (*_on_state_change_cb)(state_t new_state);
 
         // private methods
-        void set_brightness(float_t brightness);
-        void cycle_loop(float hue, float t, float angle, bool refresh = false);
+        Renderer::snapshot_t render_snapshot();
+        void send_render_state();
         uint16_t get_paused_time();
-        float_t get_effective_brightness();
-        bool transition_loop(bool force);
         void set_cycle(bool v);
         uint32_t encoder_colour_by_mode(ENCODER_MODE mode);
         void encoder_loop();
@@ -121,10 +150,6 @@ namespace ledcontrol {
         int _save_state_to_flash();
 
         // strings
-        const char *effect_str[EFFECT_COUNT] = {
-            "hue_cycle",
-            "white_chase",
-        };
         const char *speed_str[SPEED_COUNT] = {
             "stopped",
             "superslow",
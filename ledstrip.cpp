@@ -0,0 +1,128 @@
+#include "ledstrip.h"
+#include <algorithm>
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "ledstrip.pio.h"
+#include "render.h"
+
+using namespace ledcontrol;
+
+static LEDStrip *_ledstrip = nullptr; // for the IRQ handler
+
+static void _ledstrip_dma_irq_handler();
+static int64_t _ledstrip_transmit_done(alarm_id_t id, void *user_data);
+
+LEDStrip::LEDStrip(uint p_num_leds, PIO p_pio, uint p_pin, bool p_rgbw, uint p_strips, uint p_freq):
+    num_leds(p_num_leds),
+    strips(std::min(std::max(p_strips, 1u), MAX_STRIPS)),
+    leds_per_strip((p_num_leds + strips - 1) / strips),
+    pio(p_pio),
+    pin(p_pin),
+    rgbw(p_rgbw),
+    freq(p_freq),
+    front(0),
+    transmitting(false),
+    pending(false)
+{
+  bits = rgbw ? 32 : 24;
+  if (strips > 1) {
+    // one byte per bit time, 4 per word
+    words = leds_per_strip * bits / 4;
+    staging = new uint32_t[strips * leds_per_strip]();
+  } else {
+    words = num_leds;
+  }
+  buffers[0] = new uint32_t[words]();
+  buffers[1] = new uint32_t[words]();
+  critical_section_init(&cs);
+
+  // TX FIFO is joined, so 8 words in the FIFO plus the one in the OSR
+  uint32_t bits_per_word = strips > 1 ? 4 : bits;
+  drain_us = (uint32_t)((uint64_t)9 * bits_per_word * 1000000 / freq) + RESET_TIME_US;
+}
+
+void LEDStrip::init() {
+  sm = pio_claim_unused_sm(pio, true);
+  if (strips > 1) {
+    uint offset = pio_add_program(pio, &ledstrip_parallel_program);
+    ledstrip_parallel_program_init(pio, sm, offset, pin, strips, freq);
+  } else {
+    uint offset = pio_add_program(pio, &ledstrip_program);
+    ledstrip_program_init(pio, sm, offset, pin, freq, bits);
+  }
+
+  dma_channel = dma_claim_unused_channel(true);
+  dma_channel_config c = dma_channel_get_default_config(dma_channel);
+  channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+  channel_config_set_read_increment(&c, true);
+  channel_config_set_write_increment(&c, false);
+  channel_config_set_dreq(&c, pio_get_dreq(pio, sm, true));
+  dma_channel_configure(dma_channel, &c, &pio->txf[sm], buffers[0], words, false);
+
+  _ledstrip = this;
+  dma_channel_set_irq0_enabled(dma_channel, true);
+  irq_add_shared_handler(DMA_IRQ_0, _ledstrip_dma_irq_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+  irq_set_enabled(DMA_IRQ_0, true);
+}
+
+void LEDStrip::present() {
+  // the back buffer isn't touched by the DMA until it's swapped in below, or by _transmit_done()
+  if (staging) render::transpose_planes(staging, (uint8_t *)buffers[front ^ 1], leds_per_strip, strips, bits / 8);
+
+  critical_section_enter_blocking(&cs);
+  if (transmitting) {
+    pending = true; // swapped in by _transmit_done()
+  } else {
+    front ^= 1;
+    start_transmit();
+  }
+  critical_section_exit(&cs);
+}
+
+void LEDStrip::wait() {
+  while (pending || transmitting) tight_loop_contents();
+}
+
+uint32_t LEDStrip::frame_time_us() const {
+  return (uint32_t)((uint64_t)leds_per_strip * bits * 1000000 / freq) + RESET_TIME_US;
+}
+
+// call with cs held
+void LEDStrip::start_transmit() {
+  transmitting = true;
+  dma_channel_set_trans_count(dma_channel, words, false);
+  dma_channel_set_read_addr(dma_channel, buffers[front], true);
+}
+
+void LEDStrip::_dma_irq_handler() {
+  if (!dma_channel_get_irq0_status(dma_channel)) return; // shared handler, not ours
+  dma_channel_acknowledge_irq0(dma_channel);
+
+  // the last word is only in the FIFO now, so the front buffer isn't free until it's clocked out and latched
+  if (add_alarm_in_us(drain_us, _ledstrip_transmit_done, this, true) < 0) {
+    busy_wait_us_32(drain_us);
+    _transmit_done();
+  }
+}
+
+int64_t LEDStrip::_transmit_done() {
+  critical_section_enter_blocking(&cs);
+  if (pending) {
+    pending = false;
+    front ^= 1;
+    start_transmit();
+  } else {
+    transmitting = false;
+  }
+  critical_section_exit(&cs);
+  return 0; // don't reschedule
+}
+
+// IRQ "bindings" to homemade static methods
+static void _ledstrip_dma_irq_handler() {
+  if (_ledstrip) _ledstrip->_dma_irq_handler();
+}
+
+static int64_t _ledstrip_transmit_done(alarm_id_t id, void *user_data) {
+  return ((LEDStrip *)user_data)->_transmit_done();
+}
@@ -0,0 +1,72 @@
+#ifndef LEDSTRIP_H
+#define LEDSTRIP_H
+
+#include <cstdint>
+#include "pico/stdlib.h"
+#include "pico/critical_section.h"
+#include "hardware/pio.h"
+
+namespace ledcontrol {
+
+    // LEDStrip is a double buffered, DMA fed WS2812/SK6812 output.
+    //
+    // Frames are written to the back buffer while the front buffer is being transmitted. present() queues the back
+    // buffer, and the swap happens once the front buffer is completely out: DMA done, PIO FIFO drained and the reset
+    // (latch) time passed. Until then ready() is false, so the buffer being clocked out is never handed out for writing.
+    //
+    // With more than one strip, the LEDs are split evenly over that many strips on consecutive pins, which are all
+    // driven at the same time by one state machine. The frame is written as usual and present() transposes it into
+    // bit planes (see render::transpose_planes), so a frame takes as long as one strip's worth of LEDs.
+    class LEDStrip {
+      public:
+        static const uint DEFAULT_SERIAL_FREQ = 800000;
+        static const uint32_t RESET_TIME_US = 300; // newer WS2812B need >280us of low to latch
+        static const uint MAX_STRIPS = 8;
+
+        LEDStrip(uint p_num_leds, PIO p_pio, uint p_pin, bool p_rgbw, uint p_strips = 1, uint p_freq = DEFAULT_SERIAL_FREQ);
+        // init claims the PIO state machine and DMA channel. The DMA IRQ is handled on the core that calls this.
+        void init();
+
+        const uint32_t num_leds;
+        const uint32_t strips;
+        const uint32_t leds_per_strip; // the last strip may be shorter, the missing LEDs are sent as black
+
+        // ready returns true if the back buffer can be written to, ie. no frame is waiting to be swapped in
+        bool ready() const { return !pending; }
+        // back_buffer returns the buffer the next frame should be written to, in PIO word format (see render::pack).
+        // Only valid while ready() is true.
+        uint32_t *back_buffer() { return staging ? staging : buffers[front ^ 1]; }
+        // present queues the back buffer for transmission. Only valid while ready() is true.
+        void present();
+        // wait blocks until everything presented has been transmitted
+        void wait();
+        // frame_time_us returns how long it takes to transmit a frame, including the reset time
+        uint32_t frame_time_us() const;
+
+        // IRQ "bindings"
+        void _dma_irq_handler();
+        int64_t _transmit_done();
+
+      private:
+        PIO pio;
+        uint pin;
+        uint sm;
+        bool rgbw;
+        uint freq;
+        uint dma_channel;
+        uint32_t bits; // per LED
+        uint32_t words; // DMA transfers per frame
+        uint32_t drain_us; // time from DMA done to the last bit out of the FIFO and OSR, plus reset time
+        critical_section_t cs;
+
+        uint32_t *buffers[2]; // as sent: pixel words, or bit planes if parallel
+        uint32_t *staging = nullptr; // parallel only: the frame being written, before it's transposed
+        volatile uint8_t front;
+        volatile bool transmitting;
+        volatile bool pending;
+
+        void start_transmit();
+    };
+}
+
+#endif //LEDSTRIP_H
@@ -0,0 +1,247 @@
+#include "logging.h"
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include "pico/critical_section.h"
+
+using namespace ledcontrol;
+
+// header of every record, followed by the arguments (see Record::put)
+typedef struct {
+    uint16_t len; // whole record, header included
+    uint8_t level;
+    uint8_t truncated;
+    const char *fmt;
+} header_t;
+
+static uint8_t _ring[logging::BUFFER_SIZE];
+static uint32_t _head = 0, _tail = 0; // bytes written and drained, free running
+static critical_section_t _cs;
+static bool _inited = false;
+static logging::stats_t _stats = {};
+static uint32_t _reported_dropped = 0;
+
+static void ring_copy_in(uint32_t pos, const uint8_t *src, uint32_t n) {
+  for (uint32_t i = 0; i < n; i++) _ring[(pos + i) % logging::BUFFER_SIZE] = src[i];
+}
+
+static void ring_copy_out(uint32_t pos, uint8_t *dst, uint32_t n) {
+  for (uint32_t i = 0; i < n; i++) dst[i] = _ring[(pos + i) % logging::BUFFER_SIZE];
+}
+
+void logging::init() {
+  critical_section_init(&_cs);
+  _inited = true;
+}
+
+logging::Record::Record(uint8_t level, const char *fmt) {
+  header_t h = {.len = 0, .level = level, .truncated = 0, .fmt = fmt};
+  memcpy(buf, &h, sizeof(h));
+  len = sizeof(h);
+}
+
+void logging::Record::put(ARG_TYPE type, const void *v, size_t n) {
+  if (truncated || len + 1 + n > MAX_RECORD) {
+    truncated = true;
+    return;
+  }
+  buf[len++] = type;
+  memcpy(&buf[len], v, n);
+  len += n;
+}
+
+void logging::Record::add(span_t v) {
+  uint8_t n = v.len < MAX_STR ? v.len : MAX_STR;
+  if (truncated || len + 2 + n > MAX_RECORD) {
+    truncated = true;
+    return;
+  }
+  buf[len++] = STR;
+  buf[len++] = n;
+  memcpy(&buf[len], v.s, n);
+  len += n;
+}
+
+void logging::Record::add(const char *v) {
+  if (v == nullptr) v = "(null)";
+  size_t n = 0;
+  while (n < MAX_STR && v[n] != '\0') n++;
+  add(span(v, n));
+}
+
+void logging::Record::commit() {
+  header_t h;
+  memcpy(&h, buf, sizeof(h));
+  h.len = len;
+  h.truncated = truncated;
+  memcpy(buf, &h, sizeof(h));
+
+  if (!_inited) {
+    _stats.dropped++;
+    return;
+  }
+
+  critical_section_enter_blocking(&_cs);
+  uint32_t used = _head - _tail;
+  if (used + len > BUFFER_SIZE) {
+    _stats.dropped++;
+  } else {
+    ring_copy_in(_head, buf, len);
+    _head += len;
+    _stats.written++;
+    if (truncated) _stats.truncated++;
+    if (used + len > _stats.high_water) _stats.high_water = used + len;
+  }
+  critical_section_exit(&_cs);
+}
+
+// next_arg returns the next argument of the record at *pos, or false if there are no more
+static bool next_arg(const uint8_t *rec, uint32_t len, uint32_t *pos, uint8_t *type, uint64_t *v, const char **s) {
+  if (*pos >= len) return false;
+  *type = rec[(*pos)++];
+  switch (*type) {
+    case logging::I32: { int32_t i; memcpy(&i, &rec[*pos], 4); *v = (uint64_t)(int64_t)i; *pos += 4; break; }
+    case logging::U32: { uint32_t u; memcpy(&u, &rec[*pos], 4); *v = u; *pos += 4; break; }
+    case logging::F32: { uint32_t u; memcpy(&u, &rec[*pos], 4); *v = u; *pos += 4; break; }
+    case logging::I64:
+    case logging::U64: memcpy(v, &rec[*pos], 8); *pos += 8; break;
+    case logging::STR: *v = rec[(*pos)++]; *s = (const char *)&rec[*pos]; *pos += *v; break;
+    default: *pos = len; return false;
+  }
+  return true;
+}
+
+// format_spec formats one printf conversion spec (eg. "%-5.2f") with the next argument(s) of the record. Any length
+// modifier in the spec is replaced to match how the argument was stored.
+static int format_spec(char *out, size_t out_len, const char *spec, size_t spec_len, const uint8_t *rec, uint32_t len, uint32_t *pos) {
+  char conv = spec[spec_len - 1];
+  char f[24];
+  size_t fl = 0;
+  int stars[2] = {0, 0};
+  int num_stars = 0;
+  uint8_t type;
+  uint64_t v;
+  const char *s = nullptr;
+
+  for (size_t i = 0; i < spec_len - 1 && fl < sizeof(f) - 4; i++) {
+    char c = spec[i];
+    if (c == 'h' || c == 'l' || c == 'z' || c == 'j' || c == 't' || c == 'L' || c == 'q') continue;
+    if (c == '*' && num_stars < 2) {
+      if (!next_arg(rec, len, pos, &type, &v, &s)) return snprintf(out, out_len, "?");
+      stars[num_stars++] = (int)(int64_t)v;
+    }
+    f[fl++] = c;
+  }
+
+  if (!next_arg(rec, len, pos, &type, &v, &s)) return snprintf(out, out_len, "?");
+
+  if (type == logging::STR) {
+    if (conv != 's') return snprintf(out, out_len, "?");
+    // the string isn't NUL terminated in the record: cap the precision at its length
+    char str[logging::MAX_STR + 1];
+    memcpy(str, s, v);
+    str[v] = '\0';
+    f[fl++] = 's';
+    f[fl] = '\0';
+    if (num_stars == 2) return snprintf(out, out_len, f, stars[0], stars[1], str);
+    if (num_stars == 1) return snprintf(out, out_len, f, stars[0], str);
+    return snprintf(out, out_len, f, str);
+  }
+
+  if (type == logging::F32) {
+    float fv;
+    uint32_t u = (uint32_t)v;
+    memcpy(&fv, &u, sizeof(fv));
+    f[fl++] = conv;
+    f[fl] = '\0';
+    if (num_stars == 2) return snprintf(out, out_len, f, stars[0], stars[1], (double)fv);
+    if (num_stars == 1) return snprintf(out, out_len, f, stars[0], (double)fv);
+    return snprintf(out, out_len, f, (double)fv);
+  }
+
+  // integers: everything is printed as long long
+  if (conv == 'p') {
+    f[fl++] = 'p';
+    f[fl] = '\0';
+    return snprintf(out, out_len, f, (void *)(uintptr_t)v);
+  }
+  if (conv == 'c') {
+    f[fl++] = 'c';
+  } else {
+    f[fl++] = 'l';
+    f[fl++] = 'l';
+    f[fl++] = conv;
+  }
+  f[fl] = '\0';
+  long long sv = type == logging::I32 || type == logging::I64 ? (long long)(int64_t)v : (long long)v;
+  if (conv == 'c') sv = (int)sv;
+  if (num_stars == 2) return snprintf(out, out_len, f, stars[0], stars[1], sv);
+  if (num_stars == 1) return snprintf(out, out_len, f, stars[0], sv);
+  return snprintf(out, out_len, f, sv);
+}
+
+// print_record formats a record like printf would have, and writes it to stdout
+static void print_record(const uint8_t *rec, uint32_t len) {
+  header_t h;
+  memcpy(&h, rec, sizeof(h));
+
+  char line[256];
+  size_t l = 0;
+  uint32_t pos = sizeof(h);
+  for (const char *p = h.fmt; *p != '\0' && l < sizeof(line) - 1; p++) {
+    if (*p != '%') {
+      line[l++] = *p;
+      continue;
+    }
+    if (p[1] == '%') {
+      line[l++] = '%';
+      p++;
+      continue;
+    }
+
+    const char *spec = p++;
+    while (*p != '\0' && strchr("diouxXcsfFeEgGaAp", *p) == nullptr) p++;
+    if (*p == '\0') break;
+
+    int n = format_spec(&line[l], sizeof(line) - l, spec, p - spec + 1, rec, len, &pos);
+    if (n > 0) l += std::min((size_t)n, sizeof(line) - 1 - l);
+  }
+  line[l] = '\0';
+  fputs(line, stdout);
+  if (h.truncated) fputs(" [truncated]\n", stdout);
+}
+
+bool logging::drain(uint32_t budget_us) {
+  uint32_t start = time_us_32();
+  uint8_t rec[MAX_RECORD];
+
+  if (!_inited) return true;
+
+  while (true) {
+    critical_section_enter_blocking(&_cs);
+    bool empty = _head == _tail;
+    critical_section_exit(&_cs);
+    if (empty) {
+      if (_stats.dropped != _reported_dropped) {
+        printf("[log] %lu records dropped\n", (unsigned long)(_stats.dropped - _reported_dropped));
+        _reported_dropped = _stats.dropped;
+      }
+      return true;
+    }
+    if (budget_us > 0 && time_us_32() - start >= budget_us) return false;
+
+    // only we move the tail, and writers only ever add past the head they saw, so the record can be read unlocked
+    header_t h;
+    ring_copy_out(_tail, (uint8_t *)&h, sizeof(h));
+    ring_copy_out(_tail, rec, h.len);
+    print_record(rec, h.len);
+
+    critical_section_enter_blocking(&_cs);
+    _tail += h.len;
+    critical_section_exit(&_cs);
+  }
+}
+
+logging::stats_t logging::get_stats() {
+  return _stats;
+}
@@ -0,0 +1,122 @@
+#ifndef LOGGING_H
+#define LOGGING_H
+
+#include <cstdint>
+#include <cstddef>
+#include <type_traits>
+#include "pico/stdlib.h"
+
+// Deferred logging. LOG_INFO(fmt, args...) and friends don't format anything: they copy the format string's address
+// and the raw arguments into a RAM ring buffer, and drain() formats and prints them later, when the main loop has
+// nothing better to do. So logging from a hot path costs a few stores instead of printf's soft-float formatting and
+// stdio output, and never blocks: if the ring is full, the record is dropped (and counted).
+//
+// The format must be a string literal (only its address is kept). The usual printf conversions work, with any length
+// modifier. String arguments are copied into the record (up to MAX_STR bytes), use logging::span() for strings that
+// aren't NUL terminated, eg. instead of "%.*s".
+//
+// Levels are compiled in or out with LEDCONTROL_LOG_LEVEL (the CMake cache variable of the same name).
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LEDCONTROL_LOG_LEVEL
+#define LEDCONTROL_LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_AT(level, ...) do { if ((level) <= LEDCONTROL_LOG_LEVEL) ledcontrol::logging::write(level, __VA_ARGS__); } while (0)
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+namespace ledcontrol {
+  namespace logging {
+
+    static const uint32_t BUFFER_SIZE = 4096; // bytes, records are 8 bytes plus their arguments
+    static const uint32_t MAX_RECORD = 192;
+    static const uint32_t MAX_STR = 64;
+
+    enum ARG_TYPE : uint8_t {
+        I32,
+        U32,
+        I64,
+        U64,
+        F32,
+        STR, // one length byte, then the characters
+    };
+
+    // span is a string argument of known length
+    typedef struct {
+        const char *s;
+        size_t len;
+    } span_t;
+    inline span_t span(const char *s, size_t len) { return {s, len}; }
+
+    // Record builds one record on the stack: header, then every argument as a type byte and its value
+    class Record {
+      public:
+        Record(uint8_t level, const char *fmt);
+
+        void add(span_t v);
+        void add(const char *v);
+        void add(char *v) { add((const char *)v); }
+        void add(double v) { float f = (float)v; put(F32, &f, sizeof(f)); }
+        void add(float v) { put(F32, &v, sizeof(v)); }
+        template <typename T>
+        void add(T v) {
+          static_assert(std::is_integral<T>::value || std::is_enum<T>::value || std::is_pointer<T>::value,
+                        "unsupported log argument type");
+          if constexpr (std::is_pointer<T>::value) {
+            uint64_t u = (uintptr_t)v;
+            put(U64, &u, sizeof(u));
+          } else if constexpr (sizeof(T) > 4) {
+            if constexpr (std::is_signed<T>::value) { int64_t i = v; put(I64, &i, sizeof(i)); }
+            else { uint64_t u = v; put(U64, &u, sizeof(u)); }
+          } else if constexpr (std::is_enum<T>::value || std::is_signed<T>::value) {
+            int32_t i = (int32_t)v;
+            put(I32, &i, sizeof(i));
+          } else {
+            uint32_t u = v;
+            put(U32, &u, sizeof(u));
+          }
+        }
+
+        void commit();
+
+      private:
+        uint8_t buf[MAX_RECORD];
+        uint32_t len;
+        bool truncated = false;
+
+        void put(ARG_TYPE type, const void *v, size_t n);
+    };
+
+    // init sets up the ring's lock. Call it once at boot, before anything logs: until then records are dropped.
+    void init();
+
+    template <typename... A>
+    void write(uint8_t level, const char *fmt, A... args) {
+      Record r(level, fmt);
+      (r.add(args), ...);
+      r.commit();
+    }
+
+    // drain formats and prints buffered records, for up to budget_us (0: until the ring is empty). Returns true if
+    // the ring is empty. Call it from one place only: the main loop when idle, or before giving up (see error_loop).
+    bool drain(uint32_t budget_us = 0);
+
+    typedef struct {
+        uint32_t written;
+        uint32_t dropped; // ring full
+        uint32_t truncated; // record didn't fit MAX_RECORD, the arguments that didn't fit are printed as '?'
+        uint32_t high_water; // bytes
+    } stats_t;
+    stats_t get_stats();
+  }
+}
+
+#endif //LOGGING_H
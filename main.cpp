@@ -1,7 +1,7 @@
 #include "pico/stdlib.h"
 #ifdef RASPBERRYPI_PICO_W
 #include "iot.h"
-#include "cjson/cJSON.h"
+#include "command.h"
 #endif
 
 #include "hardware/flash.h"
@@ -10,6 +10,10 @@
 #include <cstring>
 #include "ledcontrol.h"
 #include "presence.h"
+#include "frameclock.h"
+#include "profile.h"
+#include "logging.h"
+#include "boot.h"
 #include "config.h"
 
 ledcontrol::LEDControl *leds = NULL;
@@ -24,18 +28,26 @@ void board_led(bool val) {
 }
 
 #ifdef RASPBERRYPI_PICO_W
-void wifi_looper() {
-  static bool looper_beeper = false;
-  static uint32_t last_looper_beeper_change = 0;
-
-  uint32_t req_ms = leds->loop();
-  sleep_ms(req_ms);
+// joining_led blinks the board LED until WiFi is up for the first time. The LED is also the paused indicator, which
+// wins: it's not blinked while paused, and shows whether we're paused again once WiFi is up.
+void joining_led() {
+  static bool joined = false;
+  static bool blink = false;
+  static uint32_t last_change = 0;
+  if (joined) return;
+
+  if (boot::get(boot::DHCP) != 0) {
+    joined = true;
+    board_led(leds->is_paused());
+    return;
+  }
+  if (leds->is_paused()) return; // lit by LEDControl::set_cycle
 
   uint32_t ts = to_ms_since_boot(get_absolute_time());
-  if (ts - last_looper_beeper_change > 500) {
-    last_looper_beeper_change = ts;
-    looper_beeper = !looper_beeper;
-    board_led(looper_beeper);
+  if (ts - last_change > 500) {
+    last_change = ts;
+    blink = !blink;
+    board_led(blink);
   }
 }
 
@@ -56,128 +68,104 @@ void on_state_change(ledcontrol::LEDControl::state_t new_state) {
 }
 
 void on_save_command(const char *data, size_t len) {
-  printf("[on_save_command] %.*s\n", len, data);
+  LOG_INFO("[on_save_command] %s\n", logging::span(data, len));
 
-  cJSON *json = cJSON_ParseWithLength(data, len);
-  if (json == NULL) {
-    cJSON_Delete(json);
-    printf("[on_save_command] json parse failed\n");
+  command::command_t cmd;
+  if (command::parse(data, len, &cmd) < 0) {
+    LOG_WARN("[on_save_command] json parse failed\n");
     return;
   }
-//  char *s = cJSON_Print(json);
-//  printf("here: %s\n", s);
-//  free(s);
 
-  auto on_off = cJSON_GetObjectItem(json, "state");
-  if (cJSON_IsString(on_off) && (on_off->valuestring != NULL) && strcmp(on_off->valuestring, "OFF") == 0) {
+  if ((cmd.fields & command::STATE) && strcmp(cmd.state, "OFF") == 0) {
     // ignore off state. any other json will pass
-    cJSON_Delete(json);
     return;
   }
 
-  cJSON_Delete(json);
+  leds->apply_pending_state(); // a command that came in just before is part of what's saved
   leds->save_state_to_flash();
 }
 
+// on_command merges a light command into the state queued for the next frame (see LEDControl::queue_state)
 void on_command(const char *data, size_t len) {
-  printf("[on_command] %.*s\n", len, data);
+  LOG_INFO("[on_command] %s\n", logging::span(data, len));
 
-  cJSON *json = cJSON_ParseWithLength(data, len);
-  if (json == NULL) {
-    cJSON_Delete(json);
-    printf("[on_command] json parse failed\n");
+  command::command_t cmd;
+  if (command::parse(data, len, &cmd) < 0) {
+    LOG_WARN("[on_command] json parse failed\n");
     return;
   }
-//  char *s = cJSON_Print(json);
-//  printf("here: %s\n", s);
-//  free(s);
 
-  auto state = leds->get_state();
+  auto state = leds->get_pending_state();
   bool changed = false;
-  {
-    auto on_off = cJSON_GetObjectItem(json, "state");
-    if (cJSON_IsString(on_off) && (on_off->valuestring != NULL)) {
-      if (strcmp(on_off->valuestring, "ON") == 0) {
-        if (state.on != true) {
-          state.on = true;
-          changed = true;
-        }
-      } else if (strcmp(on_off->valuestring, "OFF") == 0) {
-        if (state.on != false) {
-          state.on = false;
-          changed = true;
-        }
-      } else {
-        printf("[on_command] received unknown state: %s\n", on_off->valuestring);
+  if (cmd.fields & command::STATE) {
+    if (strcmp(cmd.state, "ON") == 0) {
+      if (state.on != true) {
+        state.on = true;
+        changed = true;
+      }
+    } else if (strcmp(cmd.state, "OFF") == 0) {
+      if (state.on != false) {
+        state.on = false;
+        changed = true;
       }
+    } else {
+      LOG_WARN("[on_command] received unknown state: %s\n", cmd.state);
     }
   }
 
-  {
-    auto effect = cJSON_GetObjectItem(json, "effect");
-    if (cJSON_IsString(effect) && (effect->valuestring != NULL)) {
-      ledcontrol::LEDControl::EFFECT_MODE eff;
-      float_t speed;
-      int res = leds->parse_effect_str((const char *)effect->valuestring, &eff, &speed);
-      if (res < 0) {
-        printf("[on_command] received unknown effect: %s\n", effect->valuestring);
-      } else {
-        if (state.effect != eff) {
-          state.effect = eff;
-          changed = true;
-        }
-        if (res == 1 && (state.speed != speed || state.stopped)) {
-          state.speed = speed;
-//          state.stopped = speed == 0.0f; // not needed as we calculate it in enable_state anyway
-          changed = true;
-        }
+  if (cmd.fields & command::EFFECT) {
+    ledcontrol::LEDControl::EFFECT_MODE eff;
+    float_t speed;
+    int res = leds->parse_effect_str(cmd.effect, &eff, &speed);
+    if (res < 0) {
+      LOG_WARN("[on_command] received unknown effect: %s\n", cmd.effect);
+    } else {
+      if (state.effect != eff) {
+        state.effect = eff;
+        changed = true;
+      }
+      if (res == 1 && (state.speed != speed || state.stopped)) {
+        state.speed = speed;
+//        state.stopped = speed == 0.0f; // not needed as we calculate it in enable_state anyway
+        changed = true;
       }
     }
   }
 
-  {
-    auto color = cJSON_GetObjectItem(json, "color");
-    if (cJSON_IsObject(color)) {
-      auto hVal = cJSON_GetObjectItem(color, "h");
-      auto hSal = cJSON_GetObjectItem(color, "s");
-      if (cJSON_IsNumber(hVal) && cJSON_IsNumber(hSal)) {
-        float h = hVal->valuedouble / 360.0f;
-        float s = hSal->valuedouble / 100.0f;
-        if (state.hue != h || state.angle != s) {
-          state.hue = h;
-          state.angle = s;
-          changed = true;
-        }
-      } else {
-        printf("[on_command] received unknown color\n");
-      }
+  if (cmd.fields & command::COLOR) {
+    float h = cmd.h / 360.0f;
+    float s = cmd.s / 100.0f;
+    if (state.hue != h || state.angle != s) {
+      state.hue = h;
+      state.angle = s;
+      changed = true;
     }
+  } else if (cmd.fields & command::COLOR_OBJECT) {
+    LOG_WARN("[on_command] received unknown color\n");
   }
 
-  {
-    auto brightness = cJSON_GetObjectItem(json, "brightness");
-    if (cJSON_IsNumber(brightness)) {
-      float b = brightness->valuedouble / 100.0f;
-      if (!std::isnan(b) && !std::isinf(b) && state.brightness != b) {
-        state.brightness = b;
-        changed = true;
-      }
+  if (cmd.fields & command::BRIGHTNESS) {
+    float b = cmd.brightness / 100.0f;
+    if (!std::isnan(b) && !std::isinf(b) && state.brightness != b) {
+      state.brightness = b;
+      changed = true;
     }
   }
 
-  cJSON_Delete(json);
+  int32_t transition_ms = -1;
+  if ((cmd.fields & command::TRANSITION) && cmd.transition >= 0) {
+    transition_ms = cmd.transition * 1000.0 < MAX_TRANSITION_DURATION ? (int32_t)(cmd.transition * 1000.0) : MAX_TRANSITION_DURATION;
+  }
 
   if (changed) {
-    printf("[on_command] applying new state\n");
-    leds->enable_state(state);
+    LOG_DEBUG("[on_command] queueing new state\n");
+    leds->queue_state(state, transition_ms);
   }
 }
 
-bool mqtt_connected = false;
-
+// on_mqtt_connect is called on every (re)connection: the retained topics may have been lost with the broker
 void on_mqtt_connect() {
-  mqtt_connected = true;
-  printf("mqtt connected\n");
+  LOG_INFO("mqtt connected\n");
   leds->set_on_state_change_cb(on_state_change);
 
   auto cur_state = leds->get_state();
@@ -204,7 +192,30 @@ void on_mqtt_connect() {
     }
   }
   iot.publish_config(buffer);
-//  iot.publish_config("", true); // save button. fails with -1 so we do it in main() below
+  iot.publish_config("", true); // save button
+  if (MQTT_DIAGNOSTICS_INTERVAL_MS > 0) iot.publish_diagnostics_config();
+}
+
+// publish_diagnostics publishes the stage timings every MQTT_DIAGNOSTICS_INTERVAL_MS
+void publish_diagnostics() {
+  static uint32_t last_publish = 0;
+  uint32_t ts = to_ms_since_boot(get_absolute_time());
+  if (MQTT_DIAGNOSTICS_INTERVAL_MS == 0 || ts - last_publish < MQTT_DIAGNOSTICS_INTERVAL_MS) return;
+  last_publish = ts;
+
+  char buffer[2048];
+  if (profile::format_json(buffer, sizeof(buffer)) < 0) {
+    LOG_WARN("[diag] buffer too small\n");
+    return;
+  }
+  iot.publish_diagnostics(buffer);
+}
+#endif
+
+#if PICO_CYW43_ARCH_POLL
+void wifi_poll() {
+  PROFILE_STAGE(WIFI_POLL);
+  cyw43_arch_poll();
 }
 #endif
 
@@ -213,6 +224,7 @@ void handle_presence() {
   uint32_t ts = to_ms_since_boot(get_absolute_time());
   if (ts - last_check < PRESENCE_CHECK_INTERVAL) return;
   last_check = ts;
+  PROFILE_STAGE(PRESENCE);
 
   auto val = !presence.is_present();
   auto s = leds->get_state();
@@ -222,7 +234,39 @@ void handle_presence() {
   leds->enable_state(s);
 }
 
+// handle_serial reads single key commands from stdio (USB or UART): 'p' prints the stage timings and command counters,
+// 'r' resets the timings, 'b' prints the boot timeline
+void handle_serial() {
+  int c = getchar_timeout_us(0);
+  if (c == 'p') {
+    profile::print();
+    auto cs = leds->get_command_stats();
+    printf("[command] queued: %lu, applied: %lu, coalesced: %lu\n", (unsigned long)cs.queued, (unsigned long)cs.applied,
+           (unsigned long)cs.coalesced);
+#ifdef RASPBERRYPI_PICO_W
+    auto ps = iot.get_publish_stats();
+    printf("[mqtt] publishes queued: %lu, coalesced: %lu, sent: %lu, failed: %lu, dropped: %lu\n",
+           (unsigned long)ps.queued, (unsigned long)ps.coalesced, (unsigned long)ps.sent, (unsigned long)ps.failed,
+           (unsigned long)ps.dropped);
+    printf("[mqtt] incoming messages coalesced: %lu, dropped: %lu\n", (unsigned long)iot.get_coalesced_messages(),
+           (unsigned long)iot.get_dropped_messages());
+#ifdef MQTT_TLS
+    auto ts = iot.get_tls_stats();
+    printf("[tls] handshakes: %lu (%lu offered a session), last/max: %lu/%lu ms, last heap: %lu bytes held, %lu peak\n",
+           (unsigned long)ts.handshakes, (unsigned long)ts.resumes_offered, (unsigned long)ts.last_ms,
+           (unsigned long)ts.max_ms, (unsigned long)ts.heap_used, (unsigned long)ts.heap_peak);
+#endif
+#endif
+  } else if (c == 'b') {
+    boot::print();
+  } else if (c == 'r') {
+    profile::reset();
+    printf("[profile] reset\n");
+  }
+}
+
 void error_loop(uint32_t delay_ms) {
+  logging::drain();
   while(true) {
     board_led(true);
     sleep_ms(delay_ms);
@@ -231,37 +275,41 @@ void error_loop(uint32_t delay_ms) {
   }
 }
 
+// main brings the LEDs up first, from the state saved in flash, and only then the radio. WiFi, DHCP, DNS and MQTT
+// come up in the background, stepped by iot.loop() from the main loop (see boot.h for the timeline).
 int main() {
   stdio_init_all();
-#ifdef RASPBERRYPI_PICO_W
-#ifdef WIFI_COUNTRY_CODE
-  if (cyw43_arch_init_with_country(WIFI_COUNTRY_CODE)) {
-#else
-  if (cyw43_arch_init()) {
-#endif
-    printf("[error] WiFi init failed\n");
-    error_loop(200);
-  }
-#endif
+  logging::init();
 
   if (false)
   {
-    board_led(true);
     while (!stdio_usb_connected()) sleep_ms(100);
     printf("hello\n");
-    board_led(false);
   }
 
   leds = new ledcontrol::LEDControl();
   leds->init(&encoder);
+  frame_clock.init(1000000 / UPDATES);
+  boot::mark(boot::LEDS);
 
 #ifdef RASPBERRYPI_PICO_W
-  auto init_val = iot.init(WIFI_SSID, WIFI_PASSWORD, CYW43_AUTH_WPA2_AES_PSK, wifi_looper, on_mqtt_connect, on_command, on_save_command);
+  // core1 keeps rendering while this loads the radio firmware
+#ifdef WIFI_COUNTRY_CODE
+  if (cyw43_arch_init_with_country(WIFI_COUNTRY_CODE)) {
+#else
+  if (cyw43_arch_init()) {
+#endif
+    printf("[error] WiFi init failed\n");
+    error_loop(200);
+  }
+  boot::mark(boot::RADIO);
+  leds->set_radio_up();
+
+  auto init_val = iot.init(WIFI_SSID, WIFI_PASSWORD, CYW43_AUTH_WPA2_AES_PSK, on_mqtt_connect, on_command, on_save_command);
   if (init_val != 0) {
     printf("[error] iot.init returned: %d\n", init_val);
     error_loop(1000);
   }
-  board_led(false); // turn off 'looper beeper'
 
   printf("Initiating MQTT connection\n");
   auto conn_val = iot.connect();
@@ -273,26 +321,25 @@ int main() {
 
   if (PRESENCE_ENABLED) presence.init(PRESENCE_PIN, PRESENCE_PIN_ACTIVE_LOW, PRESENCE_UART_TX_PIN, PRESENCE_UART_RX_PIN);
 
-  bool save_published = false;
   while(true) {
 #if PICO_CYW43_ARCH_POLL
-    cyw43_arch_poll();
-    sleep_ms(1);
+    wifi_poll();
 #endif
-    sleep_ms(leds->loop());
+    leds->loop();
     if (PRESENCE_ENABLED) handle_presence();
+    handle_serial();
+    logging::drain(LOG_DRAIN_BUDGET_US); // what's left is printed next frame
 
 #ifdef RASPBERRYPI_PICO_W
-    // consecutive publish calls fail, so we need to wait a bit
-    if (mqtt_connected && !save_published) {
-        sleep_ms(100);
-#if PICO_CYW43_ARCH_POLL
-        cyw43_arch_poll();
-        sleep_ms(1);
+    if (iot.is_connected()) publish_diagnostics();
+    iot.loop(); // (re)connect, send what was published this frame
+    joining_led();
 #endif
-        save_published = true;
-        iot.publish_config("", true); // save button
-    }
+
+#if PICO_CYW43_ARCH_POLL
+    frame_clock.wait(wifi_poll); // WiFi interrupts wake us up too, service them without waiting for the frame
+#else
+    frame_clock.wait();
 #endif
   }
 }
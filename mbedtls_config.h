@@ -65,3 +65,4 @@
 // these were added for ledcontrol
 #define MBEDTLS_BASE64_C
 #define MBEDTLS_PEM_PARSE_C
+#define MBEDTLS_SSL_SESSION_TICKETS // resume sessions when reconnecting, see MQTT_TLS_SESSION_RESUMPTION
@@ -3,6 +3,7 @@
 #include "hardware/gpio.h"
 #include "hardware/uart.h"
 #include "config.h"
+#include "logging.h"
 
 
 Presence::Presence(): u(PRESENCE_UART) {
@@ -67,16 +68,16 @@ bool Presence::is_present() {
     if (pin_active_low) val = !val;
   } else if (uart_enabled) {
     if (!sns->readPresenceDetection(&val)) {
-      printf("[presence] readPresenceDetection failed, returning previous value (%d)\n", last_val);
+      LOG_WARN("[presence] readPresenceDetection failed, returning previous value (%d)\n", last_val);
       return last_val;
     }
   } else {
-    printf("[presence] unhandled condition\n");
+    LOG_WARN("[presence] unhandled condition\n");
     return true;
   }
 
   if (val != last_val) {
-        printf("[presence] %s\n", val ? "present" : "absent");
+        LOG_INFO("[presence] %s\n", val ? "present" : "absent");
         last_val = val;
   }
 
@@ -0,0 +1,76 @@
+#include "profile.h"
+#include <cstdio>
+
+using namespace ledcontrol;
+
+const char *profile::stage_names[STAGE_COUNT] = {
+  "render",
+  "transmit",
+  "transition",
+  "wifi_poll",
+  "mqtt_cb",
+  "presence",
+  "buttons",
+};
+
+static profile::stage_stats_t _stages[profile::STAGE_COUNT];
+
+static uint8_t bucket(uint32_t us) {
+  if (us == 0) return 0;
+  uint8_t b = 32 - __builtin_clz(us);
+  return b < profile::BUCKETS ? b : profile::BUCKETS - 1;
+}
+
+void profile::record(STAGE stage, uint32_t us) {
+  auto &s = _stages[stage];
+  if (s.count == 0 || us < s.min_us) s.min_us = us;
+  if (us > s.max_us) s.max_us = us;
+  s.total_us += us;
+  s.hist[bucket(us)]++;
+  s.count++;
+}
+
+profile::stage_stats_t profile::get(STAGE stage) {
+  return _stages[stage];
+}
+
+void profile::reset() {
+  for (auto &s : _stages) s = {};
+}
+
+int profile::format_json(char *buf, size_t len) {
+  size_t l = 0;
+  auto append = [&](int n) {
+    if (n < 0 || l + n >= len) return false;
+    l += n;
+    return true;
+  };
+
+  if (!append(snprintf(buf, len, "{"))) return -1;
+  for (uint8_t i = 0; i < STAGE_COUNT; i++) {
+    auto s = get((STAGE)i);
+    if (!append(snprintf(&buf[l], len - l, "%s\"%s\":{\"n\":%lu,\"min\":%lu,\"avg\":%lu,\"max\":%lu,\"hist\":[",
+                         i ? "," : "", stage_names[i], (unsigned long)s.count, (unsigned long)s.min_us,
+                         (unsigned long)(s.count ? s.total_us / s.count : 0), (unsigned long)s.max_us))) return -1;
+    for (uint8_t b = 0; b < BUCKETS; b++) {
+      if (!append(snprintf(&buf[l], len - l, "%s%lu", b ? "," : "", (unsigned long)s.hist[b]))) return -1;
+    }
+    if (!append(snprintf(&buf[l], len - l, "]}"))) return -1;
+  }
+  if (!append(snprintf(&buf[l], len - l, "}"))) return -1;
+  return (int)l;
+}
+
+void profile::print() {
+#if !LEDCONTROL_PROFILE
+  printf("[profile] compiled out (LEDCONTROL_PROFILE=0)\n");
+#endif
+  printf("[profile] stage: count, min/avg/max us, histogram (log2 us buckets: <1, 1, 2-3, 4-7, ...)\n");
+  for (uint8_t i = 0; i < STAGE_COUNT; i++) {
+    auto s = get((STAGE)i);
+    printf("[profile] %s: %lu, %lu/%lu/%lu us,", stage_names[i], (unsigned long)s.count, (unsigned long)s.min_us,
+           (unsigned long)(s.count ? s.total_us / s.count : 0), (unsigned long)s.max_us);
+    for (auto h : s.hist) printf(" %lu", (unsigned long)h);
+    printf("\n");
+  }
+}
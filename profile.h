@@ -0,0 +1,80 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <cstdint>
+#include <cstddef>
+#include "pico/stdlib.h"
+
+// Per-stage timing of the hot paths: count, min/avg/max and a log2 histogram of how long each stage took.
+//
+// PROFILE_STAGE(stage) times the rest of the enclosing scope. Building with LEDCONTROL_PROFILE=0 (the CMake option of
+// the same name) compiles it out completely; the rest of the API stays, and reports nothing recorded.
+//
+// The RP2040's M0+ cores have no cycle counter, so stages are timed with the 1MHz system timer. Every stage is only
+// recorded from one core (render, transmit and transition on core1, the rest on core0), so there are no locks: a
+// snapshot taken from the other core may be torn across a single update, which is fine for diagnostics.
+
+#ifndef LEDCONTROL_PROFILE
+#define LEDCONTROL_PROFILE 1
+#endif
+
+namespace ledcontrol {
+  namespace profile {
+
+    enum STAGE : uint8_t {
+        RENDER = 0,   // Renderer::cycle_loop
+        TRANSMIT,     // Renderer::update_strip: brightness scale and handing the frame to the strip
+        TRANSITION,   // brightness transition step
+        WIFI_POLL,    // cyw43_arch_poll
+        MQTT_CB,      // incoming MQTT message callbacks
+        PRESENCE,     // handle_presence
+        BUTTONS,      // wait_for_long_button
+
+        STAGE_COUNT
+    };
+
+    // bucket i counts samples of [2^(i-1), 2^i) us, bucket 0 is under 1us and the last one is everything above
+    static const uint8_t BUCKETS = 16;
+
+    typedef struct {
+        uint32_t count;
+        uint32_t min_us;
+        uint32_t max_us;
+        uint64_t total_us;
+        uint32_t hist[BUCKETS];
+    } stage_stats_t;
+
+    extern const char *stage_names[STAGE_COUNT];
+
+    void record(STAGE stage, uint32_t us);
+    stage_stats_t get(STAGE stage);
+    void reset();
+
+    // format_json writes all stages as a JSON object keyed by stage name. Returns the length, or -1 if buf is too short.
+    int format_json(char *buf, size_t len);
+    // print writes a table of all stages to stdio
+    void print();
+
+    // Scope records the time from its construction to its destruction
+    class Scope {
+      public:
+        explicit Scope(STAGE p_stage) : stage(p_stage), start_us(time_us_32()) {}
+        ~Scope() { record(stage, time_us_32() - start_us); }
+
+      private:
+        STAGE stage;
+        uint32_t start_us;
+    };
+  }
+}
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+#if LEDCONTROL_PROFILE
+#define PROFILE_STAGE(stage) ledcontrol::profile::Scope PROFILE_CONCAT(_profile_scope_, __LINE__)(ledcontrol::profile::stage)
+#else
+#define PROFILE_STAGE(stage) do {} while (0)
+#endif
+
+#endif //PROFILE_H
@@ -0,0 +1,102 @@
+#include "render.h"
+#include <cmath>
+#include <algorithm>
+
+using namespace ledcontrol;
+
+render::frame_params_t render::frame_params(float hue, float t, float angle, float brightness) {
+  frame_params_t p;
+
+  hue = hue - floorf(hue);
+  p.hue = (uint32_t)(hue * 65536.0f) & 0xFFFF;
+  p.angle = (int32_t)(std::min(1.0f, std::max(0.0f, angle)) * 32768.0f);
+  p.value = (uint32_t)(std::min(1.0f, std::max(0.0f, brightness)) * 255.0f * 256.0f);
+
+  // the float path evaluates sin((i/num_leds + 0.5 + t) * pi): that's (i/num_leds + 0.5 + t) / 2 turns.
+  // the i/num_leds part is in the SineTable.
+  float turns = (0.5f + t) / 2.0f;
+  turns -= floorf(turns);
+  p.phase = (uint32_t)(turns * 65536.0f) << 16;
+
+  return p;
+}
+
+render::SineTable::~SineTable() {
+  delete[] table;
+}
+
+void render::SineTable::build(uint32_t p_num_leds) {
+  if (table != nullptr && num_leds == p_num_leds) return;
+
+  delete[] table;
+  num_leds = p_num_leds;
+  stride = num_leds > 0 ? (MIN_LEN + 2 * num_leds - 1) / (2 * num_leds) : 1;
+  len = 2 * num_leds * stride;
+  if (len == 0) len = MIN_LEN;
+
+  table = new int16_t[len + 1];
+  for (uint32_t i = 0; i < len; i++) {
+    table[i] = (int16_t)std::min(32767.0f, roundf(sinf(2.0f * (float)M_PI * (float)i / (float)len) * 32768.0f));
+  }
+  table[len] = table[0];
+}
+
+uint32_t render::brightness_scale(float brightness) {
+  auto b = (uint8_t)(std::min(1.0f, std::max(0.0f, brightness)) * 255.0f);
+  return (pimoroni::GAMMA_8BIT[b] * 256 + 127) / 255;
+}
+
+static inline uint32_t rotl(uint32_t x, uint32_t r) {
+  return (x << r) | (x >> (32 - r));
+}
+
+uint32_t render::scale_frame(const uint32_t *src, uint32_t *dst, uint32_t num_leds, uint32_t scale) {
+  // MurmurHash3 (x86_32): the rotations carry every bit of a word into the low bits too, so a change in a channel in
+  // the top byte (green, in GRB order) can't cancel out or be lost off the top, as it could with FNV-1a over words
+  uint32_t hash = 0;
+  for (uint32_t i = 0; i < num_leds; i++) {
+    uint32_t px = scale_swar(src[i], scale);
+    dst[i] = px;
+    uint32_t k = rotl(px * 0xcc9e2d51u, 15) * 0x1b873593u;
+    hash = rotl(hash ^ k, 13) * 5 + 0xe6546b64u;
+  }
+
+  hash ^= num_leds * 4;
+  hash ^= hash >> 16; hash *= 0x85ebca6bu;
+  hash ^= hash >> 13; hash *= 0xc2b2ae35u;
+  hash ^= hash >> 16;
+  return hash;
+}
+
+// transpose8 transposes an 8x8 bit matrix, given as two words of four rows each with the first row in the top byte.
+// Row i of the result is column i of the input (column 0 being the MSB). Hacker's Delight, transpose8rS32.
+static inline void transpose8(uint32_t *x, uint32_t *y) {
+  uint32_t t;
+  t = (*x ^ (*x >> 7)) & 0x00AA00AA;  *x = *x ^ t ^ (t << 7);
+  t = (*y ^ (*y >> 7)) & 0x00AA00AA;  *y = *y ^ t ^ (t << 7);
+  t = (*x ^ (*x >> 14)) & 0x0000CCCC; *x = *x ^ t ^ (t << 14);
+  t = (*y ^ (*y >> 14)) & 0x0000CCCC; *y = *y ^ t ^ (t << 14);
+  t = (*x & 0xF0F0F0F0) | ((*y >> 4) & 0x0F0F0F0F);
+  *y = ((*x << 4) & 0xF0F0F0F0) | (*y & 0x0F0F0F0F);
+  *x = t;
+}
+
+void render::transpose_planes(const uint32_t *src, uint8_t *dst, uint32_t leds_per_strip, uint32_t strips, uint32_t bytes) {
+  uint32_t px[8] = {};
+  for (uint32_t i = 0; i < leds_per_strip; i++) {
+    for (uint32_t s = 0; s < strips; s++) px[s] = src[s * leds_per_strip + i];
+
+    for (uint32_t k = 0; k < bytes; k++) {
+      uint32_t shift = 24 - k * 8;
+      // strip 7 is the top row, so that strip s ends up in bit s of every output row
+      uint32_t x = ((px[7] >> shift) & 0xFF) << 24 | ((px[6] >> shift) & 0xFF) << 16 |
+                   ((px[5] >> shift) & 0xFF) << 8 | ((px[4] >> shift) & 0xFF);
+      uint32_t y = ((px[3] >> shift) & 0xFF) << 24 | ((px[2] >> shift) & 0xFF) << 16 |
+                   ((px[1] >> shift) & 0xFF) << 8 | ((px[0] >> shift) & 0xFF);
+      transpose8(&x, &y);
+      dst[0] = x >> 24; dst[1] = x >> 16; dst[2] = x >> 8; dst[3] = x;
+      dst[4] = y >> 24; dst[5] = y >> 16; dst[6] = y >> 8; dst[7] = y;
+      dst += 8;
+    }
+  }
+}
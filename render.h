@@ -0,0 +1,156 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <cstdint>
+#include <common/pimoroni_common.hpp>
+#include <drivers/plasma/ws2812.hpp>
+
+// Integer render kernels for the RP2040. The Cortex-M0+ has no FPU, so every float operation in the per-LED loop is a
+// soft-float library call. Everything in here only uses 32-bit integer adds, shifts and (single cycle) multiplies.
+//
+// Fixed point conventions:
+//  - phase: uint32_t turns, 2^32 == one full circle (wraps for free)
+//  - hue: Q16 turns, 65536 == 360 degrees
+//  - sine/angle: Q15, 32768 == 1.0
+//  - value: Q8 of the 0..255 channel value, 65280 == 255.0
+//  - brightness scale: Q8, 256 == 1.0
+//
+// Frames are rendered at full brightness, gamma corrected and packed in the LEDStrip pixel word format. Brightness is
+// a separate output stage (scale_frame) so fades don't need to re-render the frame.
+//
+// Rough cost per LED (HUE_CYCLE, estimated from instruction and ROM soft-float call counts, flash-resident code). Flash
+// the ledcontrol_bench target (bench.cpp) for measured numbers:
+//  - float path: ~13 soft-float ops (2x int->float, 2x fdiv, 4x fadd, 4x fmul, float->int) plus sinf(), floorf() and
+//    set_hsv()'s own float math: roughly 1500-2000 cycles
+//  - this path: one interpolated SineTable read, 4 multiplies, a few shifts and 4 gamma lookups: roughly 60-80 cycles,
+//    plus ~15 cycles in the scale_frame output stage
+
+namespace ledcontrol {
+  namespace render {
+
+    typedef struct {
+        uint32_t hue;   // Q16 turns
+        int32_t angle;  // Q15
+        uint32_t phase; // turns, phase of the first LED
+        uint32_t value; // Q8
+    } frame_params_t;
+
+    // frame_params converts the float state into per-frame fixed point parameters. t is the animation time already
+    // divided down to "half turns" (the float path's `t / 200.0f`).
+    frame_params_t frame_params(float hue, float t, float angle, float brightness);
+
+    // SineTable caches the sine for every LED position of a strip. The spatial part of the gradient only depends on the
+    // LED index and the strip length, so per frame only the phase moves: the render loop walks the table with a fixed
+    // stride and interpolates by the (per frame constant) sub-entry fraction of the phase.
+    class SineTable {
+      public:
+        SineTable() = default;
+        ~SineTable();
+
+        // build (re)builds the table for the given strip length. It's a no-op if the length didn't change.
+        void build(uint32_t p_num_leds);
+
+        // cursor returns the table position of the given phase, and the fraction (Q16) between that and the next entry
+        uint32_t cursor(uint32_t phase, uint32_t *frac) const {
+          uint64_t pos = (uint64_t)phase * len;
+          *frac = (uint32_t)(pos >> 16) & 0xFFFF;
+          return (uint32_t)(pos >> 32);
+        }
+
+        // at returns the (Q15) sine at the given cursor, and advances it to the next LED
+        int32_t at(uint32_t *pos, uint32_t frac) const {
+          int32_t a = table[*pos];
+          int32_t v = a + (((table[*pos + 1] - a) * (int32_t)frac) >> 16);
+          *pos += stride;
+          if (*pos >= len) *pos -= len;
+          return v;
+        }
+
+      private:
+        // the table covers one full turn (2 * num_leds positions), but never with less than this many entries so
+        // that the interpolation error on short strips stays well below 1 LSB of output
+        static const uint32_t MIN_LEN = 512;
+
+        int16_t *table = nullptr;
+        uint32_t num_leds = 0;
+        uint32_t stride = 0; // entries per LED
+        uint32_t len = 0;    // entries per turn, table has one more (wrapped) entry at the end
+
+        SineTable(const SineTable&) = delete;
+        SineTable& operator=(const SineTable&) = delete;
+    };
+
+    // hue_at returns the hue (Q16 turns, wrapped) for the given (Q15) sine of the LED's phase
+    static inline uint32_t hue_at(const frame_params_t &p, int32_t sine) {
+      return (p.hue + ((sine * p.angle) >> 14)) & 0xFFFF;
+    }
+
+    // hsv_q16 is plasma::WS2812::set_hsv() for s = 1.0f, in integer math
+    static inline void hsv_q16(uint32_t h, uint32_t value, uint8_t *r, uint8_t *g, uint8_t *b) {
+      uint32_t h6 = h * 6;
+      uint32_t f = h6 & 0xFFFF;
+      uint8_t v = value >> 8;
+      uint8_t t = (value * f) >> 24;
+      uint8_t q = (value * (0x10000 - f)) >> 24;
+
+      switch (h6 >> 16) {
+        case 0: default: *r = v; *g = t; *b = 0; break;
+        case 1: *r = q; *g = v; *b = 0; break;
+        case 2: *r = 0; *g = v; *b = t; break;
+        case 3: *r = 0; *g = q; *b = v; break;
+        case 4: *r = t; *g = 0; *b = v; break;
+        case 5: *r = v; *g = 0; *b = q; break;
+      }
+    }
+
+    // white_q16 is the WHITE_CHASE intensity: (1 - h) * value, where a wrapped hue of 0 counts as a full turn
+    static inline uint8_t white_q16(uint32_t h, uint32_t value) {
+      if (h == 0) return 0;
+      return ((0x10000 - h) * value) >> 24;
+    }
+
+    // PixelFormat is where each channel goes in a pixel word (same layout as plasma::WS2812::RGB). The MSB goes out
+    // first, white is always the lowest byte (and never shifted out on RGB strips). It's a compile time parameter of the
+    // render loops, so they have neither a per LED lookup nor a branch on the strip type.
+    template <bool RGBW_, plasma::WS2812::COLOR_ORDER ORDER>
+    struct PixelFormat {
+        typedef plasma::WS2812::COLOR_ORDER O;
+
+        static constexpr bool RGBW = RGBW_;
+        static constexpr uint8_t R_SHIFT = (ORDER == O::RGB || ORDER == O::RBG) ? 24 : (ORDER == O::GBR || ORDER == O::BGR) ? 8 : 16;
+        static constexpr uint8_t G_SHIFT = (ORDER == O::GRB || ORDER == O::GBR) ? 24 : (ORDER == O::RBG || ORDER == O::BRG) ? 8 : 16;
+        static constexpr uint8_t B_SHIFT = (ORDER == O::BRG || ORDER == O::BGR) ? 24 : (ORDER == O::RBG || ORDER == O::GBR) ? 16 : 8;
+
+        // pack returns the gamma corrected pixel word, same as plasma::WS2812::set_rgb() would store
+        static inline uint32_t pack(uint8_t r, uint8_t g, uint8_t b, uint8_t w) {
+          using pimoroni::GAMMA_8BIT;
+          return ((uint32_t)GAMMA_8BIT[r] << R_SHIFT) | ((uint32_t)GAMMA_8BIT[g] << G_SHIFT) |
+                 ((uint32_t)GAMMA_8BIT[b] << B_SHIFT) | GAMMA_8BIT[w];
+        }
+    };
+
+    // brightness_scale returns the scale for the given brightness. Pixels are already gamma corrected, so the
+    // brightness goes through the same curve: gamma(b) * gamma(x) == gamma(b * x) for the power law table.
+    uint32_t brightness_scale(float brightness);
+
+    // scale_swar scales all four channels of a pixel word with two multiplies: red/blue and green/white are each
+    // done as two 16-bit lanes in one 32-bit word. scale <= 256 keeps every lane product under 16 bits, and 256 is a no-op.
+    static inline uint32_t scale_swar(uint32_t px, uint32_t scale) {
+      uint32_t rb = (((px & 0x00FF00FF) * scale) >> 8) & 0x00FF00FF;
+      uint32_t gw = (((px >> 8) & 0x00FF00FF) * scale) & 0xFF00FF00;
+      return rb | gw;
+    }
+
+    // scale_frame is the output stage: dst = src * scale, for every pixel word. It returns a hash (MurmurHash3 over the
+    // words) of what was written to dst, so unchanged frames can be detected without keeping a copy of the last one.
+    uint32_t scale_frame(const uint32_t *src, uint32_t *dst, uint32_t num_leds, uint32_t scale);
+
+    // transpose_planes turns pixel words of up to 8 strips into bit planes for parallel output: one byte per bit
+    // time, bit s of each byte is the bit strip s sends at that time. Strip s is src[s * leds_per_strip ...], the
+    // first `bytes` bytes of each word are sent, MSB first. dst gets leds_per_strip * bytes * 8 bytes.
+    void transpose_planes(const uint32_t *src, uint8_t *dst, uint32_t leds_per_strip, uint32_t strips, uint32_t bytes);
+
+  }
+}
+
+#endif //RENDER_H
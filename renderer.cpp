@@ -0,0 +1,169 @@
+#include "renderer.h"
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include <algorithm>
+
+#include "util.h"
+#include "profile.h"
+#include "config.h"
+
+using namespace ledcontrol;
+
+static Renderer *_renderer = nullptr; // for the core1 entry point
+
+static void _renderer_core1_entry();
+
+Renderer::Renderer(uint num_leds, PIO pio, uint pin, uint strips):
+    led_strip(num_leds, pio, pin, LED_RGBW, strips)
+{
+  frame = new uint32_t[led_strip.num_leds]();
+  renderers = effects::renderers();
+}
+
+void Renderer::start() {
+  _renderer = this;
+  multicore_launch_core1(_renderer_core1_entry);
+}
+
+void Renderer::_run() {
+  // so that core0 can pause us while writing to flash
+  multicore_lockout_victim_init();
+
+  // claim the PIO, DMA and alarm from here, so their IRQs are handled on this core
+  led_strip.init();
+  clock.init(1000000 / UPDATES);
+  governor.rate = UPDATES;
+
+  while (true) {
+    step();
+    clock.wait();
+  }
+}
+
+void Renderer::step() {
+  bool changed = false;
+  while (snapshots.pop(&snap)) changed = true;
+
+  uint32_t ts = millis();
+  uint32_t start_us = time_us_32();
+  bool rendered = snap.cycle || changed;
+  if (rendered) {
+    uint32_t t = (snap.cycle ? ts : snap.stop_time) - snap.start_time;
+    cycle_loop(snap.hue, (float)t * snap.speed, snap.angle);
+  }
+
+  {
+    PROFILE_STAGE(TRANSITION);
+    // we do this to prevent flickering
+    float_t b = snap.blackout ? 0.0f : effective_brightness(snap, ts);
+    if (b != eff_brightness) set_brightness(b);
+  }
+
+  update_strip();
+
+  if (rendered) {
+    uint32_t cost = time_us_32() - start_us;
+    governor.render_us = governor.render_us == 0 ? cost : (governor.render_us * 7 + cost) / 8;
+  }
+  govern(ts);
+  publish_stats();
+}
+
+// govern picks the frame rate: as low as the animation allows without stepping any channel more than FRAME_MAX_STEP
+// levels between frames, the full rate during fades and for a while after input, and never more than the strip and the
+// render loop can keep up with.
+void Renderer::govern(uint32_t ts) {
+  bool fading = snap.transition_start_time != 0 && ts >= snap.transition_start_time &&
+                ts <= snap.transition_start_time + snap.transition_duration;
+  bool input = snap.input_time != 0 && ts - snap.input_time < INPUT_FULL_RATE_MS;
+
+  uint32_t rate;
+  if (fading || input) {
+    rate = UPDATES;
+  } else if (!snap.cycle || eff_brightness == 0.0f) { // static, or black (off, blacked out)
+    rate = MIN_UPDATES;
+  } else {
+    // every LED's hue is hue + angle * sin(phase), and the phase turns 2.5 * speed times a second (t / 200 half turns
+    // per ms, see cycle_loop), so a hue moves 5pi * angle * speed turns a second at most
+    uint8_t effect = snap.effect < effects::All::count ? snap.effect : 0;
+    float_t levels = 5.0f * (float_t)M_PI * snap.angle * snap.speed * effects::All::levels_per_turn[effect];
+    rate = std::min((uint32_t)UPDATES, std::max((uint32_t)MIN_UPDATES, (uint32_t)ceilf(levels / FRAME_MAX_STEP)));
+  }
+
+  // rendering and transmitting overlap (the strip is double buffered), so the slower of the two sets the limit
+  uint32_t cost_us = std::max(led_strip.frame_time_us(), governor.render_us);
+  cost_us += cost_us / 8;
+  governor.max_rate = std::max(1u, std::min((uint32_t)UPDATES, 1000000 / std::max(1u, cost_us)));
+  rate = std::min(rate, (uint32_t)governor.max_rate);
+
+  if (rate == governor.rate) return;
+  governor.rate = rate;
+  governor.changes++;
+  clock.set_period(1000000 / rate);
+}
+
+float_t Renderer::effective_brightness(const snapshot_t &s, uint32_t ts) {
+  if (s.transition_start_time == 0 || s.transition_duration == 0 || ts < s.transition_start_time ||
+      ts > s.transition_start_time + s.transition_duration) {
+    return s.brightness;
+  }
+
+  // sinusoidal transition
+  float_t t = (float_t)(ts - s.transition_start_time) / (float_t)s.transition_duration;
+  float_t b = (1.0f - cosf(t * M_PI)) / 2.0f;
+  return (s.transition_start_brightness + b * (s.transition_target_brightness - s.transition_start_brightness));
+}
+
+void Renderer::set_brightness(float_t brightness) {
+  eff_brightness = brightness;
+  frame_dirty = true;
+}
+
+// update_strip applies the effective brightness to the rendered frame and sends it to the LEDs, unless it's the same
+// as what was sent last time. If the previous frame is still waiting to go out, the frame stays dirty and the next call
+// picks it up.
+void Renderer::update_strip() {
+  if (!frame_dirty || !led_strip.ready()) return;
+  PROFILE_STAGE(TRANSMIT);
+  frame_dirty = false;
+
+  uint32_t hash = render::scale_frame(frame, led_strip.back_buffer(), led_strip.num_leds, render::brightness_scale(eff_brightness));
+  if (output_stats.frames_sent > 0 && hash == sent_hash) {
+    output_stats.frames_skipped++;
+    return;
+  }
+
+  led_strip.present();
+  sent_hash = hash;
+  output_stats.frames_sent++;
+}
+
+// publish_stats copies the output and governor stats for get_output_stats and get_governor_stats, which core0 calls
+// while core1 changes them: the 64-bit bus_us_saved, or the rate and its max_rate, could be read half updated
+void Renderer::publish_stats() {
+  output_stats.bus_us_saved = (uint64_t)output_stats.frames_skipped * led_strip.frame_time_us();
+  published_output.store(output_stats);
+  governor.missed = clock.get_stats().missed;
+  published_governor.store(governor);
+}
+
+// cycle_loop renders a full brightness frame. call update_strip() after this.
+void Renderer::cycle_loop(float hue, float t, float angle) {
+  PROFILE_STAGE(RENDER);
+  sine.build(led_strip.num_leds);
+  effects::frame_t f = {
+    .frame = frame,
+    .num_leds = led_strip.num_leds,
+    .sine = &sine,
+    .p = render::frame_params(hue, t / 200.0f, angle, 1.0f),
+  };
+
+  // effect and strip type are the same for the whole frame, so they're picked once here instead of per LED
+  effects::All::render(renderers, snap.effect, f);
+
+  frame_dirty = true;
+}
+
+static void _renderer_core1_entry() {
+  _renderer->_run();
+}
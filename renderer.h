@@ -0,0 +1,106 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <cstdint>
+#include <cmath>
+#include <drivers/plasma/ws2812.hpp>
+#include "render.h"
+#include "effects.h"
+#include "ledstrip.h"
+#include "spsc_queue.h"
+#include "seqlock.h"
+#include "frameclock.h"
+
+namespace ledcontrol {
+
+    // Renderer owns the render and transmit pipeline, and runs it on core1 so that networking and input handling on
+    // core0 can't stall the animation. It never reads LEDControl's state: core0 sends it complete snapshots of
+    // everything a frame depends on through a lock-free queue, and it keeps using the latest one it received.
+    class Renderer {
+      public:
+        typedef struct {
+            float_t hue;
+            float_t angle;
+            float_t speed;
+            uint8_t effect; // effects::All index, same as LEDControl::EFFECT_MODE
+            bool cycle; // animating. if not, animation time is frozen at stop_time
+            bool blackout; // output black regardless of brightness (used while saving to flash)
+            uint32_t start_time, stop_time; // ms, animation time is (now, or stop_time if not cycling) - start_time
+
+            // brightness to settle at, and the transition towards it
+            float_t brightness;
+            uint32_t transition_start_time;
+            uint32_t transition_duration;
+            float_t transition_start_brightness;
+            float_t transition_target_brightness;
+
+            uint32_t input_time; // ms, last encoder input, 0 if none. Keeps the frame rate up for a while.
+        } snapshot_t;
+
+        // output stats: frames that were identical to the last one sent aren't sent again
+        typedef struct {
+            uint32_t frames_sent;
+            uint32_t frames_skipped;
+            uint64_t bus_us_saved; // WS2812 transmit time not spent because of skipped frames
+        } output_stats_t;
+
+        // frame-rate governor stats, see govern()
+        typedef struct {
+            uint16_t rate;      // frames per second, as picked for the current snapshot
+            uint16_t max_rate;  // what the strip transmit time and the render cost allow
+            uint32_t render_us; // average cost of a rendered frame, on core1
+            uint32_t changes;   // times the rate changed
+            uint32_t missed;    // render deadlines missed, same as the render clock's
+        } governor_stats_t;
+
+        // the strip type is LED_RGBW and LED_ORDER from config.h, the render loops are compiled for it
+        Renderer(uint num_leds, PIO pio, uint pin, uint strips = 1);
+
+        // start launches the render loop on core1
+        void start();
+        // send queues a new snapshot for the render loop, and wakes it up to render it right away. core0 only.
+        // returns false if the queue is full.
+        bool send(const snapshot_t &s) {
+          if (!snapshots.push(s)) return false;
+          clock.wake();
+          return true;
+        }
+        FrameClock::stats_t get_clock_stats() { return clock.get_stats(); }
+        // the stats as of the last frame, consistent even while core1 updates them
+        output_stats_t get_output_stats() { return published_output.load(); }
+        governor_stats_t get_governor_stats() { return published_governor.load(); }
+
+        // effective_brightness is the brightness of the given snapshot at time ts, following the transition
+        static float_t effective_brightness(const snapshot_t &s, uint32_t ts);
+
+        // core1 entry point, never returns
+        void _run();
+
+      private:
+        LEDStrip led_strip;
+        const effects::render_fn *renderers; // for this strip type
+        render::SineTable sine;
+        uint32_t *frame; // last rendered frame, full brightness
+        bool frame_dirty = false; // frame or brightness changed since the last update_strip()
+        uint32_t sent_hash = 0; // of the last frame sent
+        output_stats_t output_stats = {};
+        float_t eff_brightness = -1.0f;
+        governor_stats_t governor = {};
+        // copies of output_stats and governor for core0, see publish_stats
+        SeqLock<output_stats_t> published_output;
+        SeqLock<governor_stats_t> published_governor;
+
+        snapshot_t snap = {};
+        SPSCQueue<snapshot_t, 8> snapshots;
+        FrameClock clock;
+
+        void step();
+        void govern(uint32_t ts);
+        void set_brightness(float_t brightness);
+        void update_strip();
+        void publish_stats();
+        void cycle_loop(float hue, float t, float angle);
+    };
+}
+
+#endif //RENDERER_H
@@ -0,0 +1,41 @@
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <atomic>
+#include <cstdint>
+
+// SeqLock publishes a value from one side (eg. core1) to the other (eg. core0) without either waiting for a lock. The
+// writer only ever calls store(): the sequence number is odd while it copies, and the reader's load() copies again
+// if the number was odd or changed under it, so it never returns a value half from one store and half from the
+// next. Like SPSCQueue, only plain loads and stores with fences are used, which the M0+ can do. The writer mustn't be
+// paused mid-store (eg. by a multicore lockout) while the other side loads.
+template <typename T>
+class SeqLock {
+  public:
+    // store publishes v. Writer side only.
+    void store(const T &v) {
+      uint32_t seq = _seq.load(std::memory_order_relaxed);
+      _seq.store(seq + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release); // the odd number is seen before any of the copy
+      value = v;
+      _seq.store(seq + 2, std::memory_order_release);
+    }
+
+    // load returns the last value stored, or a value-initialized T before the first store
+    T load() const {
+      T v;
+      uint32_t seq;
+      do {
+        seq = _seq.load(std::memory_order_acquire);
+        v = value;
+        std::atomic_thread_fence(std::memory_order_acquire); // the copy is done before the number is checked again
+      } while ((seq & 1) != 0 || seq != _seq.load(std::memory_order_relaxed));
+      return v;
+    }
+
+  private:
+    T value{};
+    std::atomic<uint32_t> _seq{0};
+};
+
+#endif //SEQLOCK_H
@@ -0,0 +1,44 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstdint>
+
+// SPSCQueue is a fixed size, lock-free, single producer/single consumer queue. One side (eg. core0) only ever calls
+// push() and the other (eg. core1) only ever calls pop(). Only plain loads and stores with acquire/release ordering
+// are used, which the M0+ can do without the exclusive access instructions it doesn't have.
+template <typename T, uint32_t N>
+class SPSCQueue {
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "SPSCQueue size must be a power of two");
+
+  public:
+    // push copies v to the queue. returns false if the queue is full.
+    bool push(const T &v) {
+      uint32_t head = _head.load(std::memory_order_relaxed);
+      if (head - _tail.load(std::memory_order_acquire) == N) return false;
+      buf[head & (N - 1)] = v;
+      _head.store(head + 1, std::memory_order_release);
+      return true;
+    }
+
+    // pop copies the oldest item to v. returns false if the queue is empty.
+    bool pop(T *v) {
+      uint32_t tail = _tail.load(std::memory_order_relaxed);
+      if (_head.load(std::memory_order_acquire) == tail) return false;
+      *v = buf[tail & (N - 1)];
+      _tail.store(tail + 1, std::memory_order_release);
+      return true;
+    }
+
+    bool empty() const {
+      return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire);
+    }
+
+  private:
+    T buf[N];
+    // free running counters, only the producer writes _head and only the consumer writes _tail
+    std::atomic<uint32_t> _head{0};
+    std::atomic<uint32_t> _tail{0};
+};
+
+#endif //SPSC_QUEUE_H
@@ -3,7 +3,7 @@
 
 #include "button.hpp"
 
-float wrap(float v, float min, float max) {
+inline float wrap(float v, float min, float max) {
   if(v <= min)
     v += (max - min);
 
@@ -13,7 +13,7 @@ float wrap(float v, float min, float max) {
   return v;
 }
 
-signed int limiting_wrap(signed int v, int min, int max) {
+inline signed int limiting_wrap(signed int v, int min, int max) {
   if(v < min)
     v += (max - min);
 
@@ -27,7 +27,7 @@ inline uint32_t millis() {
   return to_ms_since_boot(get_absolute_time());
 }
 
-uint8_t wait_for_long_button(pimoroni::Button b, uint16_t long_duration) {
+inline uint8_t wait_for_long_button(pimoroni::Button b, uint16_t long_duration) {
   uint8_t cur_mode = 0;
   uint32_t start = millis();
   while (b.raw()) {
@@ -45,7 +45,7 @@ uint8_t wait_for_long_button(pimoroni::Button b, uint16_t long_duration) {
   return cur_mode;
 }
 
-void print_buf(const uint8_t *buf, size_t len) {
+inline void print_buf(const uint8_t *buf, size_t len) {
   for (size_t i = 0; i < len; ++i) {
     printf("%02x", buf[i]);
     if (i % 16 == 15)